@@ -7,12 +7,13 @@ uniform sampler2D al_tex;
 uniform sampler2D displacement;
 varying vec2 varying_texcoord;
 varying vec4 varying_color;
+uniform vec4 region; // where the bitmap lies within its texture, as it may be a sub-bitmap
 
 
 void main() {
 
 	vec2 pos = varying_texcoord;
-	vec4 dis = texture2D(displacement, pos);
+	vec4 dis = texture2D(displacement, (pos - region.xy) / (region.zw - region.xy));
 	vec4 color = texture2D(al_tex, pos);
 
 color -= vec4(dis.g * 0.3);
@@ -0,0 +1,42 @@
+#ifdef GL_ES
+precision mediump float;
+#endif
+
+uniform sampler2D al_tex;
+uniform vec2 halfpixel;
+uniform bool up;
+varying vec2 varying_texcoord;
+varying vec4 varying_color;
+
+// https://community.arm.com/cfs-file/__key/communityserver-blogs-components-weblogfiles/00-00-00-26-50/siggraph2015_2D00_mmg_2D00_marius_2D00_notes.pdf
+// Each pass reads a single level of the chain, so both filters run in multiple passes:
+// downsampling into progressively smaller targets, then upsampling back.
+
+vec4 downsample(sampler2D tex, vec2 uv, vec2 halfpixel) {
+	vec4 sum = texture2D(tex, uv) * 4.0;
+	sum += texture2D(tex, uv - halfpixel.xy);
+	sum += texture2D(tex, uv + halfpixel.xy);
+	sum += texture2D(tex, uv + vec2(halfpixel.x, -halfpixel.y));
+	sum += texture2D(tex, uv - vec2(halfpixel.x, -halfpixel.y));
+	return sum / 8.0;
+}
+
+vec4 upsample(sampler2D tex, vec2 uv, vec2 halfpixel) {
+	vec4 sum = texture2D(tex, uv + vec2(-halfpixel.x * 2.0, 0.0));
+	sum += texture2D(tex, uv + vec2(-halfpixel.x, halfpixel.y)) * 2.0;
+	sum += texture2D(tex, uv + vec2(0.0, halfpixel.y * 2.0));
+	sum += texture2D(tex, uv + vec2(halfpixel.x, halfpixel.y)) * 2.0;
+	sum += texture2D(tex, uv + vec2(halfpixel.x * 2.0, 0.0));
+	sum += texture2D(tex, uv + vec2(halfpixel.x, -halfpixel.y)) * 2.0;
+	sum += texture2D(tex, uv + vec2(0.0, -halfpixel.y * 2.0));
+	sum += texture2D(tex, uv + vec2(-halfpixel.x, -halfpixel.y)) * 2.0;
+	return sum / 12.0;
+}
+
+void main() {
+	if (up) {
+		gl_FragColor = upsample(al_tex, varying_texcoord, halfpixel) * varying_color;
+	} else {
+		gl_FragColor = downsample(al_tex, varying_texcoord, halfpixel) * varying_color;
+	}
+}
@@ -13,6 +13,10 @@ uniform bool invert;
 uniform bool inplace;
 uniform bool active;
 uniform float time;
+uniform vec4 region; // where the bitmap lies within its texture, as it may be a sub-bitmap
+uniform sampler2D warp; // the wavy offset below, evaluated on the CPU once per frame
+uniform bool lut;
+uniform float warp_range;
 
 float insideBox(vec2 v, vec2 bottomLeft, vec2 topRight) {
 	vec2 s = step(bottomLeft, v) - step(topRight, v);
@@ -67,51 +71,37 @@ vec4 KawaseBlurFilter( sampler2D tex, vec2 texCoord, vec2 pixelSize, float itera
 	return cOut;
 }
 
-// https://community.arm.com/cfs-file/__key/communityserver-blogs-components-weblogfiles/00-00-00-26-50/siggraph2015_2D00_mmg_2D00_marius_2D00_notes.pdf
-// also, remember that both algos should actually be done in multiple passes...
-
-vec4 downsample(sampler2D tex, vec2 uv, vec2 halfpixel) {
-	vec4 sum = clampTexture2D(tex, uv) * 4.0;
-	sum += clampTexture2D(tex, uv - halfpixel.xy);
-	sum += clampTexture2D(tex, uv + halfpixel.xy);
-	sum += clampTexture2D(tex, uv + vec2(halfpixel.x, -halfpixel.y));
-	sum += clampTexture2D(tex, uv - vec2(halfpixel.x, -halfpixel.y));
-	return sum / 8.0;
-}
-vec4 upsample(sampler2D tex, vec2 uv, vec2 halfpixel) {
-	vec4 sum = clampTexture2D(tex, uv + vec2(-halfpixel.x * 2.0, 0.0));
-	sum += clampTexture2D(tex, uv + vec2(-halfpixel.x, halfpixel.y)) * 2.0;
-	sum += clampTexture2D(tex, uv + vec2(0.0, halfpixel.y * 2.0));
-	sum += clampTexture2D(tex, uv + vec2(halfpixel.x, halfpixel.y)) * 2.0;
-	sum += clampTexture2D(tex, uv + vec2(halfpixel.x * 2.0, 0.0));
-	sum += clampTexture2D(tex, uv + vec2(halfpixel.x, -halfpixel.y)) * 2.0;
-	sum += clampTexture2D(tex, uv + vec2(0.0, -halfpixel.y * 2.0));
-	sum += clampTexture2D(tex, uv + vec2(-halfpixel.x, -halfpixel.y)) * 2.0;
-	return sum / 12.0;
-}
-
-
 void main() {
 	float t = time / 16.0;
 
-	vec2 pos = varying_texcoord;
+	vec2 uv = (varying_texcoord - region.xy) / (region.zw - region.xy);
+	vec2 pos = uv;
+	if (lut) {
+		// lower half: both terms depending on uv.y, upper half: the one depending on uv.x
+		vec2 rows = texture2D(warp, vec2(uv.y, 0.25)).rg;
+		float columns = texture2D(warp, vec2(uv.x, 0.75)).r;
+		vec2 offset = (vec2(rows.r, rows.g + columns) * 2.0 - vec2(1.0, 2.0)) * warp_range;
+		pos = clamp(uv + offset, 0.0, 1.0);
+	} else {
 	//if (!inplace) {
 		float y =
-			0.7*sin(mod((varying_texcoord.y + t) * 4.0, tau)) * 0.038 +
-			0.3*sin(mod((varying_texcoord.y + t) * 8.0, tau)) * 0.010 +
-			0.05*sin(mod((varying_texcoord.y + t) * 40.0, tau)) * 0.05;
+			0.7*sin(mod((uv.y + t) * 4.0, tau)) * 0.038 +
+			0.3*sin(mod((uv.y + t) * 8.0, tau)) * 0.010 +
+			0.05*sin(mod((uv.y + t) * 40.0, tau)) * 0.05;
 
 		float x =
-			0.5*sin(mod((varying_texcoord.y + t) * 5.0, tau)) * 0.1 +
-			0.2*sin(mod((varying_texcoord.x + t) * 10.0, tau)) * 0.05 +
-			0.2*sin(mod((varying_texcoord.x + t) * 30.0, tau)) * 0.02;
+			0.5*sin(mod((uv.y + t) * 5.0, tau)) * 0.1 +
+			0.2*sin(mod((uv.x + t) * 10.0, tau)) * 0.05 +
+			0.2*sin(mod((uv.x + t) * 30.0, tau)) * 0.02;
 
-		pos = clamp(1.0 * (varying_texcoord + vec2(y, x) / 8.0), 0.0, 1.0);
+		pos = clamp(1.0 * (uv + vec2(y, x) / 8.0), 0.0, 1.0);
 	//}
+	}
 
-	vec4 dis = clampTexture2D(displacement, pos);
+	vec4 dis = texture2D(displacement, pos);
 
 	pos += dis.rg / 256.0;
+	pos = region.xy + pos * (region.zw - region.xy);
 
 	vec4 color = clampTexture2D(al_tex, pos) * (1.0 - dis.r * 0.2);
 
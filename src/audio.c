@@ -0,0 +1,281 @@
+/*! \file audio.c
+ *  \brief Sound synthesized on the fly in the mixer callbacks.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <libsuperderpy.h>
+#include <stdio.h>
+
+#define OSCILLATOR_MAX_ERROR 1e-5 // what the sine approximation is allowed to be off by, checked by the benchmark
+#define TONE_READ_ATTEMPTS 4
+#define BENCHMARK_RATE 44100
+#define BENCHMARK_SECONDS 60
+#define BENCHMARK_BUFFER 1024 // frames per mixer callback
+
+// Four consecutive frames get computed at once. Phases are kept in turns, so wrapping them is just
+// subtracting the nearest integer. The sine is then folded into a quarter of the period and evaluated
+// with an odd polynomial (Taylor series up to x^9, under 4e-6 off within [-pi/2, pi/2]).
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define AUDIO_SIMD "SSE2"
+
+typedef __m128 f4;
+
+static inline f4 f4_splat(float f) { return _mm_set1_ps(f); }
+static inline f4 f4_set(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+static inline f4 f4_ramp(float a, float step) { return _mm_setr_ps(a, a + step, a + step * 2, a + step * 3); }
+static inline f4 f4_mul(f4 a, f4 b) { return _mm_mul_ps(a, b); }
+static inline f4 f4_wrap(f4 v) { return _mm_sub_ps(v, _mm_cvtepi32_ps(_mm_cvtps_epi32(v))); } // rounds to nearest
+static inline void f4_store(float* p, f4 v) { _mm_storeu_ps(p, v); }
+
+static inline f4 f4_sin_turns(f4 x) {
+	// x in [-0.5, 0.5]
+	f4 sign = _mm_and_ps(x, _mm_set1_ps(-0.0f));
+	f4 a = _mm_xor_ps(x, sign);
+	a = _mm_min_ps(a, _mm_sub_ps(_mm_set1_ps(0.5f), a));
+	f4 r = _mm_mul_ps(a, _mm_set1_ps(2 * ALLEGRO_PI));
+	f4 r2 = _mm_mul_ps(r, r);
+	f4 p = _mm_set1_ps(1 / 362880.0f);
+	p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(-1 / 5040.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(1 / 120.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(-1 / 6.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, r2), _mm_set1_ps(1.0f));
+	return _mm_xor_ps(_mm_mul_ps(p, r), sign);
+}
+
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define AUDIO_SIMD "NEON"
+
+typedef float32x4_t f4;
+
+static inline f4 f4_splat(float f) { return vdupq_n_f32(f); }
+static inline f4 f4_set(float a, float b, float c, float d) {
+	float values[4] = {a, b, c, d};
+	return vld1q_f32(values);
+}
+static inline f4 f4_ramp(float a, float step) { return f4_set(a, a + step, a + step * 2, a + step * 3); }
+static inline f4 f4_mul(f4 a, f4 b) { return vmulq_f32(a, b); }
+static inline f4 f4_wrap(f4 v) {
+	// round half away from zero, which is as good as any other rounding here
+	f4 half = vbslq_f32(vdupq_n_u32(0x80000000), v, vdupq_n_f32(0.5f));
+	return vsubq_f32(v, vcvtq_f32_s32(vcvtq_s32_f32(vaddq_f32(v, half))));
+}
+static inline void f4_store(float* p, f4 v) { vst1q_f32(p, v); }
+
+static inline f4 f4_sin_turns(f4 x) {
+	f4 a = vabsq_f32(x);
+	a = vminq_f32(a, vsubq_f32(vdupq_n_f32(0.5f), a));
+	f4 r = vmulq_n_f32(a, 2 * ALLEGRO_PI);
+	f4 r2 = vmulq_f32(r, r);
+	f4 p = vdupq_n_f32(1 / 362880.0f);
+	p = vaddq_f32(vmulq_f32(p, r2), vdupq_n_f32(-1 / 5040.0f));
+	p = vaddq_f32(vmulq_f32(p, r2), vdupq_n_f32(1 / 120.0f));
+	p = vaddq_f32(vmulq_f32(p, r2), vdupq_n_f32(-1 / 6.0f));
+	p = vaddq_f32(vmulq_f32(p, r2), vdupq_n_f32(1.0f));
+	return vbslq_f32(vdupq_n_u32(0x80000000), x, vmulq_f32(p, r));
+}
+
+#else
+#define AUDIO_SIMD "scalar"
+
+typedef struct {
+	float c[4];
+} f4;
+
+static inline f4 f4_splat(float f) { return (f4){{f, f, f, f}}; }
+static inline f4 f4_set(float a, float b, float c, float d) { return (f4){{a, b, c, d}}; }
+static inline f4 f4_ramp(float a, float step) { return (f4){{a, a + step, a + step * 2, a + step * 3}}; }
+static inline f4 f4_mul(f4 a, f4 b) { return (f4){{a.c[0] * b.c[0], a.c[1] * b.c[1], a.c[2] * b.c[2], a.c[3] * b.c[3]}}; }
+static inline f4 f4_wrap(f4 v) { return (f4){{v.c[0] - rintf(v.c[0]), v.c[1] - rintf(v.c[1]), v.c[2] - rintf(v.c[2]), v.c[3] - rintf(v.c[3])}}; }
+static inline void f4_store(float* p, f4 v) { memcpy(p, v.c, sizeof(v.c)); }
+
+static inline f4 f4_sin_turns(f4 x) {
+	f4 out;
+	for (int i = 0; i < 4; i++) {
+		float a = fabsf(x.c[i]);
+		float r = fminf(a, 0.5f - a) * 2 * ALLEGRO_PI;
+		float r2 = r * r;
+		float p = (((r2 / 362880.0f - 1 / 5040.0f) * r2 + 1 / 120.0f) * r2 - 1 / 6.0f) * r2 + 1.0f;
+		out.c[i] = copysignf(p * r, x.c[i]);
+	}
+	return out;
+}
+#endif
+
+void RenderOscillator(struct Oscillator* osc, float* buffer, unsigned int frames, int channels, struct ToneParams from, struct ToneParams to) {
+	// Increments are in turns per frame. Both parameters move linearly from one set to the other over
+	// the buffer, so changes made by the game don't step audibly.
+	double increment = from.increment, slope = (to.increment - from.increment) / (double)frames;
+	float gain_slope = (to.gain - from.gain) / frames;
+	if (from.gain != 0 || to.gain != 0) {
+		float values[4];
+		for (unsigned int i = 0; i < frames; i += 4) {
+			// Stepping a float phase along would drift by its rounding error, so every group starts
+			// from the double precision position instead. That's a few multiply-adds per four frames.
+			double start = osc->phase + i * increment + slope * i * (i - 1.0) / 2.0;
+			double local = increment + i * slope;
+			start -= floor(start);
+			local -= floor(local);
+			f4 phase = f4_wrap(f4_set(start, start + local, start + local * 2 + slope, start + local * 3 + slope * 3));
+			f4_store(values, f4_mul(f4_sin_turns(phase), f4_ramp(from.gain + i * gain_slope, gain_slope)));
+			// the same signal goes to every channel of the interleaved frames
+			for (unsigned int j = 0; j < 4 && i + j < frames; j++) {
+				for (int c = 0; c < channels; c++) {
+					buffer[(i + j) * channels + c] += values[j];
+				}
+			}
+		}
+	}
+	osc->phase += frames * increment + slope * frames * (frames - 1.0) / 2.0;
+	osc->phase -= floor(osc->phase);
+}
+
+void PublishToneParams(struct ToneChannel* channel, struct ToneParams params) {
+	// Sequence lock with a single writer: an odd sequence number means an update is in progress.
+	unsigned int sequence = atomic_load_explicit(&channel->sequence, memory_order_relaxed);
+	atomic_store_explicit(&channel->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&channel->increment, params.increment, memory_order_relaxed);
+	atomic_store_explicit(&channel->gain, params.gain, memory_order_relaxed);
+	atomic_store_explicit(&channel->sequence, sequence + 2, memory_order_release);
+}
+
+bool ReadToneParams(struct ToneChannel* channel, struct ToneParams* params) {
+	// Never waits for the writer; when it keeps getting in the way, the caller stays with what it had.
+	for (int i = 0; i < TONE_READ_ATTEMPTS; i++) {
+		unsigned int sequence = atomic_load_explicit(&channel->sequence, memory_order_acquire);
+		if (sequence & 1) {
+			continue;
+		}
+		struct ToneParams read = {
+			.increment = atomic_load_explicit(&channel->increment, memory_order_relaxed),
+			.gain = atomic_load_explicit(&channel->gain, memory_order_relaxed),
+		};
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&channel->sequence, memory_order_relaxed) == sequence) {
+			*params = read;
+			return true;
+		}
+	}
+	return false;
+}
+
+void RenderTone(struct Tone* tone, float* buffer, unsigned int frames, int channels) {
+	// picks up whatever the game published last and glides there over this buffer
+	struct ToneParams target = tone->current;
+	ReadToneParams(&tone->channel, &target);
+	RenderOscillator(&tone->osc, buffer, frames, channels, tone->current, target);
+	tone->current = target;
+}
+
+float GetSampleValue(ALLEGRO_SAMPLE* sample, unsigned int frame, int channel) {
+	// single frames of a sample's data, for tools working on decoded audio outside of a mixer
+	int channels = al_get_channel_count(al_get_sample_channels(sample));
+	unsigned int index = frame * channels + (channel < channels ? channel : channels - 1);
+	switch (al_get_sample_depth(sample)) {
+		case ALLEGRO_AUDIO_DEPTH_INT8:
+			return ((int8_t*)al_get_sample_data(sample))[index] / 128.0f;
+		case ALLEGRO_AUDIO_DEPTH_INT16:
+			return ((int16_t*)al_get_sample_data(sample))[index] / 32768.0f;
+		case ALLEGRO_AUDIO_DEPTH_INT24:
+			return ((int32_t*)al_get_sample_data(sample))[index] / 8388608.0f;
+		case ALLEGRO_AUDIO_DEPTH_FLOAT32:
+			return ((float*)al_get_sample_data(sample))[index];
+		default:
+			return 0;
+	}
+}
+
+double GetAudioStreamPlayedSecs(ALLEGRO_AUDIO_STREAM* stream) {
+	// the stream's position is how far it has been decoded, the fragments still queued haven't been heard yet
+	unsigned int queued = al_get_audio_stream_fragments(stream) - al_get_available_audio_stream_fragments(stream);
+	double position = al_get_audio_stream_position_secs(stream) - queued * al_get_audio_stream_length(stream) / (double)al_get_audio_stream_frequency(stream);
+	return position > 0 ? position : 0;
+}
+
+static double ReferenceOscillator(double* counter, float* buffer, unsigned int frames, int channels, double increment, float gain) {
+	// the plain per-sample computation the oscillator is checked against; returns the largest difference
+	double error = 0;
+	for (unsigned int i = 0; i < frames; i++) {
+		double value = sin(fmod(*counter * increment, 1.0) * 2 * ALLEGRO_PI) * gain;
+		*counter += 1;
+		for (int c = 0; c < channels; c++) {
+			error = fmax(error, fabs(buffer[i * channels + c] - value));
+		}
+	}
+	return error;
+}
+
+int RunOscillatorBenchmark(int* argc, char** argv) {
+	// bob --benchmark-oscillator: measures the oscillator outside of the game and verifies its output;
+	// returns -1 when not requested, so the game can start normally
+	bool requested = false;
+	int out = 1;
+	for (int i = 1; i < *argc; i++) {
+		if (strcmp(argv[i], "--benchmark-oscillator") == 0) {
+			requested = true;
+		} else {
+			argv[out++] = argv[i];
+		}
+	}
+	*argc = out;
+	if (!requested) {
+		return -1;
+	}
+	al_init(); // for the timer
+
+	const int channels = 2;
+	const unsigned int callbacks = BENCHMARK_RATE * BENCHMARK_SECONDS / BENCHMARK_BUFFER;
+	float* buffer = malloc(sizeof(float) * BENCHMARK_BUFFER * channels);
+	// the same range of pitches the game uses: 32 * tint.r / (1 + val) radians per frame
+	const double increments[] = {32 * 0.75 / (2 * ALLEGRO_PI), 32 * 0.75 / 1.5 / (2 * ALLEGRO_PI), 32 * 0.75 / 3.0 / (2 * ALLEGRO_PI), 440.0 / BENCHMARK_RATE};
+	int failed = 0;
+
+	printf("Oscillator benchmark (%s), %d s of stereo audio at %d Hz in %d frame buffers\n", AUDIO_SIMD, BENCHMARK_SECONDS, BENCHMARK_RATE, BENCHMARK_BUFFER);
+	for (size_t n = 0; n < sizeof(increments) / sizeof(increments[0]); n++) {
+		struct Oscillator osc = {0};
+		struct ToneParams tone = {.increment = increments[n], .gain = 1.0};
+		double counter = 0, error = 0, elapsed = 0;
+		for (unsigned int i = 0; i < callbacks; i++) {
+			memset(buffer, 0, sizeof(float) * BENCHMARK_BUFFER * channels);
+			double start = al_get_time();
+			RenderOscillator(&osc, buffer, BENCHMARK_BUFFER, channels, tone, tone);
+			elapsed += al_get_time() - start;
+			error = fmax(error, ReferenceOscillator(&counter, buffer, BENCHMARK_BUFFER, channels, tone.increment, tone.gain));
+		}
+
+		// what the mixer callback used to do, timed for comparison
+		double reference = al_get_time();
+		for (unsigned int i = 0; i < callbacks; i++) {
+			for (unsigned int j = 0; j < BENCHMARK_BUFFER * channels; j++) {
+				buffer[j] += sinf(fmod((i * BENCHMARK_BUFFER * channels + j) * increments[n] * 2 * ALLEGRO_PI, 2 * ALLEGRO_PI));
+			}
+		}
+		reference = al_get_time() - reference;
+
+		bool ok = error <= OSCILLATOR_MAX_ERROR;
+		failed += !ok;
+		printf("  %.4f turns/frame: %.2f ns/frame (was %.2f), max error %.2e %s\n", increments[n] - floor(increments[n]),
+			elapsed / (callbacks * BENCHMARK_BUFFER) * 1e9, reference / (callbacks * BENCHMARK_BUFFER) * 1e9, error, ok ? "ok" : "FAILED");
+	}
+	free(buffer);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,343 @@
+/*! \file audiorender.c
+ *  \brief Offline, faster than real time playback of the audio recorded during a capture.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <libsuperderpy.h>
+#include <stdio.h>
+
+#define RENDER_BUFFER 1024 // frames pulled at once, like a mixer callback would get
+#define RENDER_CHANNELS 2
+#define RENDER_MAX_VOICES 32
+#define RENDER_MAX_SOUNDS 16
+
+// Allegro can't pull from a mixer without an audio device behind it, so the renderer rebuilds
+// the game's mixer graph: the music stream goes through the same DSP chain as the game's music
+// mixer, the voice lines through the voice mixer, the intro and ending sounds through the engine's
+// music and fx mixers, all of them into the master mixer. The resampling and the summing are its
+// own though, so the result is close to what the game plays, not identical to it.
+
+struct RenderEvent {
+	double time;
+	char line[1024]; // with the time stripped
+};
+
+struct RenderSource {
+	ALLEGRO_SAMPLE* sample;
+	double position; // in frames of the sample
+	bool playing, loop;
+};
+
+struct RenderSound {
+	char name[32];
+	bool fx; // on the fx mixer, the music mixer otherwise
+	struct RenderSource source;
+};
+
+static bool LoadAudioLog(const char* path, struct RenderEvent** events, int* count) {
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "Couldn't open audio log %s\n", path);
+		return false;
+	}
+	char line[1100];
+	while (fgets(line, sizeof(line), file)) {
+		struct RenderEvent event = {0};
+		int offset = 0;
+		if (sscanf(line, "%lf %n", &event.time, &offset) < 1) {
+			continue;
+		}
+		snprintf(event.line, sizeof(event.line), "%s", line + offset);
+		event.line[strcspn(event.line, "\r\n")] = 0;
+		*events = realloc(*events, sizeof(struct RenderEvent) * (*count + 1));
+		(*events)[(*count)++] = event;
+	}
+	fclose(file);
+	return true;
+}
+
+static void MixSource(struct RenderSource* source, float* bus, unsigned int frames, unsigned int rate) {
+	if (!source->playing || !source->sample) {
+		return;
+	}
+	unsigned int length = al_get_sample_length(source->sample);
+	double step = al_get_sample_frequency(source->sample) / (double)rate;
+	// mono gets spread evenly over both channels
+	float spread = al_get_channel_count(al_get_sample_channels(source->sample)) == 1 ? sqrtf(0.5f) : 1.0f;
+	for (unsigned int i = 0; i < frames; i++) {
+		if (source->position >= length) {
+			if (!source->loop) {
+				source->playing = false;
+				source->position = 0;
+				return;
+			}
+			source->position -= length;
+		}
+		unsigned int a = source->position;
+		unsigned int b = a + 1 < length ? a + 1 : (source->loop ? 0 : a);
+		float t = source->position - a;
+		for (int c = 0; c < RENDER_CHANNELS; c++) {
+			bus[i * RENDER_CHANNELS + c] += (GetSampleValue(source->sample, a, c) * (1 - t) + GetSampleValue(source->sample, b, c) * t) * spread;
+		}
+		source->position += step;
+	}
+}
+
+static void WriteWavHeader(FILE* file, unsigned int rate, unsigned int frames) {
+	// 32-bit float, so the output can be compared without any dithering in the way
+	uint32_t data = frames * RENDER_CHANNELS * sizeof(float);
+	uint32_t riff = data + 36, fmt = 16, byte_rate = rate * RENDER_CHANNELS * sizeof(float);
+	uint16_t format = 3, channels = RENDER_CHANNELS, align = RENDER_CHANNELS * sizeof(float), bits = 32;
+	fwrite("RIFF", 1, 4, file);
+	fwrite(&riff, 4, 1, file);
+	fwrite("WAVEfmt ", 1, 8, file);
+	fwrite(&fmt, 4, 1, file);
+	fwrite(&format, 2, 1, file);
+	fwrite(&channels, 2, 1, file);
+	fwrite(&rate, 4, 1, file);
+	fwrite(&byte_rate, 4, 1, file);
+	fwrite(&align, 2, 1, file);
+	fwrite(&bits, 2, 1, file);
+	fwrite("data", 1, 4, file);
+	fwrite(&data, 4, 1, file);
+}
+
+static int CompareWithReference(const char* output, const char* reference, double tolerance) {
+	// both written by WriteWavHeader, so the samples start at the same offset
+	FILE* a = fopen(output, "rb");
+	FILE* b = fopen(reference, "rb");
+	if (!a || !b) {
+		fprintf(stderr, "Couldn't open %s for comparison\n", a ? reference : output);
+		if (a) { fclose(a); }
+		if (b) { fclose(b); }
+		return 1;
+	}
+	fseek(a, 44, SEEK_SET);
+	fseek(b, 44, SEEK_SET);
+	float x, y;
+	double worst = 0, sum = 0;
+	unsigned long count = 0, mismatched = 0;
+	bool ended_a, ended_b;
+	while (true) {
+		ended_a = fread(&x, sizeof(float), 1, a) != 1;
+		ended_b = fread(&y, sizeof(float), 1, b) != 1;
+		if (ended_a || ended_b) {
+			break;
+		}
+		double diff = fabs(x - y);
+		worst = fmax(worst, diff);
+		sum += diff * diff;
+		mismatched += diff > tolerance;
+		count++;
+	}
+	fclose(a);
+	fclose(b);
+
+	bool failed = mismatched || ended_a != ended_b;
+	printf("Compared with %s: %s - max difference %.3g, RMS %.3g, %lu of %lu samples over tolerance %g%s\n", reference, failed ? "FAILED" : "ok",
+		worst, count ? sqrt(sum / count) : 0, mismatched, count, tolerance, ended_a != ended_b ? ", lengths differ" : "");
+	return failed ? 1 : 0;
+}
+
+int RunAudioRender(int* argc, char** argv) {
+	// bob --render-audio <capture/audio.txt> <out.wav> [--audio-reference <ref.wav>] [--audio-tolerance <x>]
+	// returns -1 when not requested, so the game can start normally
+	const char *log = NULL, *output = NULL, *reference = NULL;
+	double tolerance = 1e-4;
+	int out = 1;
+	for (int i = 1; i < *argc; i++) {
+		if (strcmp(argv[i], "--render-audio") == 0 && i + 2 < *argc) {
+			log = argv[++i];
+			output = argv[++i];
+		} else if (strcmp(argv[i], "--audio-reference") == 0 && i + 1 < *argc) {
+			reference = argv[++i];
+		} else if (strcmp(argv[i], "--audio-tolerance") == 0 && i + 1 < *argc) {
+			tolerance = strtod(argv[++i], NULL);
+		} else {
+			argv[out++] = argv[i];
+		}
+	}
+	*argc = out;
+	if (!log) {
+		return -1;
+	}
+
+	struct RenderEvent* events = NULL;
+	int count = 0;
+	if (!LoadAudioLog(log, &events, &count) || !count) {
+		free(events);
+		return 1;
+	}
+	FILE* file = fopen(output, "wb");
+	if (!file) {
+		fprintf(stderr, "Couldn't write %s\n", output);
+		free(events);
+		return 1;
+	}
+	al_init();
+	al_init_acodec_addon();
+
+	unsigned int rate = 44100;
+	for (int i = 0; i < count; i++) {
+		sscanf(events[i].line, "rate %u", &rate);
+		// the sounds the game took from its data pack get loaded from there too, as that's what was heard
+		if (strncmp(events[i].line, "pack ", 5) == 0 && !OpenDataPackAt(events[i].line + 5)) {
+			fprintf(stderr, "Couldn't open the data pack %s\n", events[i].line + 5);
+		}
+	}
+	float master = 1, music_gain = 1, voice_gain = 1, fx_gain = 1;
+	struct RenderSource music = {.loop = true};
+	struct RenderSource voices[RENDER_MAX_VOICES] = {0};
+	struct RenderSound sounds[RENDER_MAX_SOUNDS] = {0};
+	int sound_count = 0;
+	struct Tone tone = {0};
+	struct DspChain chain, master_chain;
+	struct Ducking duck = {0};
+	struct Limiter limiter = {0};
+	SetupMusicDsp(&chain, &tone, &duck, rate);
+	SetupMasterDsp(&master_chain, &limiter, rate);
+	float music_bus[RENDER_BUFFER * RENDER_CHANNELS], voice_bus[RENDER_BUFFER * RENDER_CHANNELS], mix[RENDER_BUFFER * RENDER_CHANNELS];
+	float direct_bus[RENDER_BUFFER * RENDER_CHANNELS], fx_bus[RENDER_BUFFER * RENDER_CHANNELS];
+
+	double start = events[0].time;
+	unsigned long frames = 0;
+	bool ended = false;
+	int next = 0;
+	double elapsed = 0;
+	WriteWavHeader(file, rate, 0);
+
+	while (!ended) {
+		// events take effect at the start of the buffer they fall into, as the callback only sees them then
+		while (next < count && (events[next].time - start) * rate < frames + RENDER_BUFFER) {
+			const char* line = events[next++].line;
+			char name[16];
+			char sound[32], action[8];
+			int voice, source;
+			float a, b;
+			if (sscanf(line, "gain %15s %f", name, &a) == 2) {
+				if (strcmp(name, "master") == 0) {
+					master = a;
+				} else if (strcmp(name, "music") == 0) {
+					music_gain = a;
+				} else if (strcmp(name, "fx") == 0) {
+					fx_gain = a;
+				} else {
+					voice_gain = a;
+				}
+			} else if (sscanf(line, "sound %31s %7s %n", sound, action, &source) == 2) {
+				int i = 0;
+				while (i < sound_count && strcmp(sounds[i].name, sound) != 0) {
+					i++;
+				}
+				if (i == sound_count && sound_count < RENDER_MAX_SOUNDS && strcmp(action, "stop") != 0) {
+					snprintf(sounds[sound_count].name, sizeof(sounds[sound_count].name), "%s", sound);
+					sounds[sound_count].fx = strcmp(action, "fx") == 0;
+					sounds[sound_count].source.sample = LoadSourceSample(strchr(line + source, ' ') + 1);
+					sound_count++;
+				}
+				if (i < sound_count) {
+					// "sound <name> <bus> play <source>" or "sound <name> stop"
+					sounds[i].source.position = 0;
+					sounds[i].source.playing = strcmp(action, "stop") != 0;
+				}
+			} else if (sscanf(line, "tone %f %f", &a, &b) == 2) {
+				PublishToneParams(&tone.channel, (struct ToneParams){.increment = a, .gain = b});
+			} else if (strncmp(line, "music play ", 11) == 0) {
+				if (!music.sample) {
+					music.sample = LoadSourceSample(line + 11);
+				}
+				music.playing = true;
+			} else if (strcmp(line, "music stop") == 0) {
+				music.playing = false;
+			} else if (sscanf(line, "voice %d %15s", &voice, name) == 2 && voice >= 0 && voice < RENDER_MAX_VOICES) {
+				if (strcmp(name, "play") == 0) {
+					if (!voices[voice].sample) {
+						voices[voice].sample = LoadSourceSample(strchr(strstr(line, "play"), ' ') + 1);
+					}
+					// every line gets a stream of its own, so a replayed one starts over
+					voices[voice].position = 0;
+					voices[voice].playing = true;
+				} else {
+					voices[voice].playing = false;
+				}
+			} else if (strcmp(line, "end") == 0) {
+				ended = true;
+			}
+		}
+		if (next == count) {
+			ended = true;
+		}
+
+		bool speaking = false;
+		for (int i = 0; i < RENDER_MAX_VOICES; i++) {
+			speaking |= voices[i].playing;
+		}
+		atomic_store(&duck.active, speaking);
+
+		double time = al_get_time();
+		memset(music_bus, 0, sizeof(music_bus));
+		memset(voice_bus, 0, sizeof(voice_bus));
+		memset(direct_bus, 0, sizeof(direct_bus));
+		memset(fx_bus, 0, sizeof(fx_bus));
+		MixSource(&music, music_bus, RENDER_BUFFER, rate);
+		ProcessDspChain(&chain, music_bus, RENDER_BUFFER);
+		for (int i = 0; i < RENDER_MAX_VOICES; i++) {
+			MixSource(&voices[i], voice_bus, RENDER_BUFFER, rate);
+		}
+		for (int i = 0; i < sound_count; i++) {
+			MixSource(&sounds[i].source, sounds[i].fx ? fx_bus : direct_bus, RENDER_BUFFER, rate);
+		}
+		for (int i = 0; i < RENDER_BUFFER * RENDER_CHANNELS; i++) {
+			// the music mixer holds the game's own music mixer and whatever the intro plays on it directly
+			mix[i] = ((music_bus[i] + direct_bus[i]) * music_gain + voice_bus[i] * voice_gain + fx_bus[i] * fx_gain) * master;
+		}
+		ProcessDspChain(&master_chain, mix, RENDER_BUFFER);
+		elapsed += al_get_time() - time;
+
+		fwrite(mix, sizeof(float), RENDER_BUFFER * RENDER_CHANNELS, file);
+		frames += RENDER_BUFFER;
+	}
+
+	fseek(file, 0, SEEK_SET);
+	WriteWavHeader(file, rate, frames);
+	fclose(file);
+
+	printf("Rendered %.1f s of audio at %u Hz to %s in %.1f ms of mixing, %.0fx real time\n", frames / (double)rate, rate, output,
+		elapsed * 1000, elapsed > 0 ? frames / (double)rate / elapsed : 0);
+	char text[512];
+	if (DescribeDspChain(&chain, text, sizeof(text))) {
+		printf("DSP: music %s\n", text);
+	}
+	if (DescribeDspChain(&master_chain, text, sizeof(text))) {
+		printf("DSP: master %s\n", text);
+	}
+
+	al_destroy_sample(music.sample);
+	for (int i = 0; i < sound_count; i++) {
+		al_destroy_sample(sounds[i].source.sample);
+	}
+	for (int i = 0; i < RENDER_MAX_VOICES; i++) {
+		al_destroy_sample(voices[i].sample);
+	}
+	free(events);
+	CloseDataPack();
+	al_uninstall_system();
+
+	return reference ? CompareWithReference(output, reference, tolerance) : 0;
+}
@@ -0,0 +1,404 @@
+/*! \file capture.c
+ *  \brief Scripted sessions that dump and verify the compositor output.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <libsuperderpy.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#define CAPTURE_EVENT_KEY ALLEGRO_GET_EVENT_TYPE('B', 'o', 'b', 'K')
+#define CAPTURE_MAX_SHOTS 16 // captures requested for a single frame
+
+enum CaptureCommand {
+	CAPTURE_KEY_DOWN,
+	CAPTURE_KEY_UP,
+	CAPTURE_SHOT,
+	CAPTURE_QUIT,
+};
+
+struct CaptureStep {
+	double time; // in seconds of game time
+	enum CaptureCommand command;
+	char arg[64];
+};
+
+// Set up from the command line before the engine even starts and read back after it's gone,
+// so it can't live in CommonResources.
+static struct {
+	bool active, update;
+	const char *script, *output, *goldens;
+	int tolerance; // per channel, out of 255
+	double failing; // fraction of pixels allowed to go over the tolerance
+
+	struct CaptureStep* steps;
+	int count, next;
+	const char* shots[CAPTURE_MAX_SHOTS];
+	int pending;
+	bool quit;
+
+	FILE* csv;
+	FILE* audio;
+	bool finished; // no more audio events, whatever gets stopped while the game shuts down
+	int frames;
+	double last, total, worst;
+	int compared, failed;
+	int broken; // checks other than the images, like the memory budgets
+	double clock; // game time, advanced by CAPTURE_STEP every frame
+} capture = {.output = "capture", .goldens = "golden", .tolerance = 8, .failing = 0.001};
+
+static bool LoadCaptureScript(const char* path) {
+	// one step per line: <time> key down|up <name>, <time> capture [name], <time> quit
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "Couldn't open capture script %s\n", path);
+		return false;
+	}
+	char line[256];
+	int n = 0;
+	while (fgets(line, sizeof(line), file)) {
+		n++;
+		struct CaptureStep step = {0};
+		char command[16] = "", arg[16] = "";
+		if (line[0] == '#' || sscanf(line, "%lf %15s", &step.time, command) < 2) {
+			continue;
+		}
+		if (strcmp(command, "key") == 0 && sscanf(line, "%*f %*s %15s %63s", arg, step.arg) == 2) {
+			step.command = strcmp(arg, "up") == 0 ? CAPTURE_KEY_UP : CAPTURE_KEY_DOWN;
+		} else if (strcmp(command, "capture") == 0) {
+			step.command = CAPTURE_SHOT;
+			if (sscanf(line, "%*f %*s %63s", step.arg) < 1) {
+				snprintf(step.arg, sizeof(step.arg), "%08.3f", step.time);
+			}
+		} else if (strcmp(command, "quit") == 0) {
+			step.command = CAPTURE_QUIT;
+		} else {
+			fprintf(stderr, "%s:%d: unknown capture step\n", path, n);
+			continue;
+		}
+		capture.steps = realloc(capture.steps, sizeof(struct CaptureStep) * (capture.count + 1));
+		capture.steps[capture.count++] = step;
+	}
+	fclose(file);
+	return true;
+}
+
+bool ParseCaptureArgs(int* argc, char** argv) {
+	// consumes its own arguments, so the engine doesn't see them
+	int out = 1;
+	for (int i = 1; i < *argc; i++) {
+		if (strcmp(argv[i], "--capture") == 0 && i + 1 < *argc) {
+			capture.script = argv[++i];
+		} else if (strcmp(argv[i], "--capture-output") == 0 && i + 1 < *argc) {
+			capture.output = argv[++i];
+		} else if (strcmp(argv[i], "--goldens") == 0 && i + 1 < *argc) {
+			capture.goldens = argv[++i];
+		} else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < *argc) {
+			capture.tolerance = strtol(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--update-goldens") == 0) {
+			capture.update = true;
+		} else {
+			argv[out++] = argv[i];
+		}
+	}
+	*argc = out;
+
+	if (!capture.script) {
+		return false;
+	}
+	capture.active = LoadCaptureScript(capture.script);
+	if (capture.active) {
+		// the software rasterizer gives the same pixels on every machine, unlike GPU drivers
+#ifdef _WIN32
+		if (!getenv("LIBGL_ALWAYS_SOFTWARE")) {
+			_putenv_s("LIBGL_ALWAYS_SOFTWARE", "1");
+		}
+#else
+		setenv("LIBGL_ALWAYS_SOFTWARE", "1", false);
+#endif
+	}
+	return capture.active;
+}
+
+bool IsCapturing(void) {
+	return capture.active;
+}
+
+double GetLogicDelta(double delta) {
+	// Captures play out in game time that advances by the same step every frame, however long the
+	// frame took to render, so the session and its goldens don't depend on the machine's speed.
+	return capture.active ? CAPTURE_STEP : delta;
+}
+
+static int FindKeycode(const char* name) {
+	for (int i = 1; i < ALLEGRO_KEY_MAX; i++) {
+		if (strcasecmp(al_keycode_to_name(i), name) == 0) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+void ProcessCaptureScript(struct Game* game, double delta) {
+	if (!capture.active) {
+		return;
+	}
+	// whatever the engine measured, everything drawn and decided this frame sees the capture's clock
+	game->time = capture.clock;
+	capture.clock += CAPTURE_STEP;
+	while (capture.next < capture.count && capture.steps[capture.next].time <= game->time) {
+		struct CaptureStep* step = &capture.steps[capture.next++];
+		switch (step->command) {
+			case CAPTURE_KEY_DOWN:
+			case CAPTURE_KEY_UP: {
+				int keycode = FindKeycode(step->arg);
+				if (!keycode) {
+					PrintConsole(game, "Capture: unknown key %s", step->arg);
+					break;
+				}
+				// Allegro only lets user events through user event sources, so it gets translated back in GlobalEventHandler
+				ALLEGRO_EVENT ev = {0};
+				ev.user.type = CAPTURE_EVENT_KEY;
+				ev.user.data1 = keycode;
+				ev.user.data2 = step->command == CAPTURE_KEY_DOWN;
+				al_emit_user_event(&game->event_source, &ev, NULL);
+				break;
+			}
+			case CAPTURE_SHOT:
+				if (capture.pending < CAPTURE_MAX_SHOTS) {
+					capture.shots[capture.pending++] = step->arg;
+				}
+				break;
+			case CAPTURE_QUIT:
+				capture.quit = true;
+				break;
+		}
+	}
+	if (capture.next == capture.count) {
+		capture.quit = true;
+	}
+}
+
+void TranslateCaptureEvent(struct Game* game, ALLEGRO_EVENT* ev) {
+	if (ev->type != CAPTURE_EVENT_KEY) {
+		return;
+	}
+	int keycode = ev->user.data1;
+	bool down = ev->user.data2;
+	ev->keyboard.type = down ? ALLEGRO_EVENT_KEY_DOWN : ALLEGRO_EVENT_KEY_UP;
+	ev->keyboard.timestamp = al_get_time();
+	ev->keyboard.display = game->display;
+	ev->keyboard.keycode = keycode;
+	ev->keyboard.unichar = 0;
+	ev->keyboard.modifiers = 0;
+	ev->keyboard.repeat = false;
+}
+
+static void CompareWithGolden(struct Game* game, ALLEGRO_BITMAP* shot, const char* name) {
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/%s.png", capture.goldens, name);
+	if (capture.update) {
+		al_make_directory(capture.goldens);
+		al_save_bitmap(path, shot);
+		PrintConsole(game, "Capture %s: golden image updated", name);
+		return;
+	}
+
+	ALLEGRO_BITMAP* golden = al_load_bitmap(path);
+	capture.compared++;
+	if (!golden) {
+		PrintConsole(game, "Capture %s: no golden image at %s", name, path);
+		capture.failed++;
+		return;
+	}
+	int w = al_get_bitmap_width(shot), h = al_get_bitmap_height(shot);
+	if (al_get_bitmap_width(golden) != w || al_get_bitmap_height(golden) != h) {
+		PrintConsole(game, "Capture %s: size %dx%d doesn't match the golden image (%dx%d)", name, w, h, al_get_bitmap_width(golden), al_get_bitmap_height(golden));
+		capture.failed++;
+		al_destroy_bitmap(golden);
+		return;
+	}
+
+	ALLEGRO_LOCKED_REGION* a = al_lock_bitmap(shot, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY);
+	ALLEGRO_LOCKED_REGION* b = al_lock_bitmap(golden, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY);
+	if (!a || !b) {
+		char reason[128];
+		snprintf(reason, sizeof(reason), "%s: couldn't lock the %s to compare it", name, a ? "golden image" : "captured frame");
+		FailCapture(game, reason);
+		if (a) {
+			al_unlock_bitmap(shot);
+		}
+		if (b) {
+			al_unlock_bitmap(golden);
+		}
+		al_destroy_bitmap(golden);
+		return;
+	}
+	int worst = 0, over = 0;
+	double sum = 0;
+	for (int y = 0; y < h; y++) {
+		const unsigned char* pa = (const unsigned char*)a->data + y * a->pitch;
+		const unsigned char* pb = (const unsigned char*)b->data + y * b->pitch;
+		for (int x = 0; x < w; x++) {
+			int error = 0;
+			for (int c = 0; c < 4; c++) {
+				int diff = abs(pa[x * 4 + c] - pb[x * 4 + c]);
+				error = diff > error ? diff : error;
+				sum += diff;
+			}
+			worst = error > worst ? error : worst;
+			over += error > capture.tolerance;
+		}
+	}
+	al_unlock_bitmap(shot);
+	al_unlock_bitmap(golden);
+	al_destroy_bitmap(golden);
+
+	bool failed = over > w * h * capture.failing;
+	capture.failed += failed;
+	PrintConsole(game, "Capture %s: %s - mean error %.3f, max %d, %d pixels (%.3f%%) over tolerance %d", name, failed ? "FAILED" : "ok",
+		sum / (w * h * 4.0), worst, over, over * 100.0 / (w * h), capture.tolerance);
+}
+
+void CaptureFrame(struct Game* game, double start) {
+	if (!capture.active) {
+		return;
+	}
+
+	// reading a pixel back waits for the GPU, so the time includes the actual rendering, not just issuing it
+	ALLEGRO_BITMAP* backbuffer = al_get_backbuffer(game->display);
+	if (al_lock_bitmap_region(backbuffer, 0, 0, 1, 1, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY)) {
+		al_unlock_bitmap(backbuffer);
+	}
+	double now = al_get_time();
+	double rendering = now - start;
+
+	if (!capture.csv) {
+		al_make_directory(capture.output);
+		char path[1024];
+		snprintf(path, sizeof(path), "%s/frames.csv", capture.output);
+		capture.csv = fopen(path, "w");
+		if (capture.csv) {
+			fprintf(capture.csv, "frame,time,frame_ms,render_ms\n");
+		}
+	}
+	if (capture.csv) {
+		fprintf(capture.csv, "%d,%f,%f,%f\n", capture.frames, game->time, capture.frames ? (now - capture.last) * 1000 : 0, rendering * 1000);
+	}
+	capture.last = now;
+	capture.frames++;
+	capture.total += rendering;
+	capture.worst = fmax(capture.worst, rendering);
+
+	if (capture.pending) {
+		int flags = al_get_new_bitmap_flags();
+		al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+		ALLEGRO_BITMAP* shot = al_clone_bitmap(backbuffer);
+		al_set_new_bitmap_flags(flags);
+
+		for (int i = 0; i < capture.pending; i++) {
+			char path[1024];
+			snprintf(path, sizeof(path), "%s/%s.png", capture.output, capture.shots[i]);
+			al_save_bitmap(path, shot);
+			CompareWithGolden(game, shot, capture.shots[i]);
+		}
+		al_destroy_bitmap(shot);
+		capture.pending = 0;
+	}
+
+	if (capture.quit) {
+		QuitGame(game, false);
+	}
+}
+
+void RecordAudioEvent(struct Game* game, const char* format, ...) {
+	// everything the offline renderer needs to play the session back (see RunAudioRender), one event per line
+	if (!capture.active || capture.finished) {
+		return;
+	}
+	if (!capture.audio) {
+		al_make_directory(capture.output);
+		char path[1024];
+		snprintf(path, sizeof(path), "%s/audio.txt", capture.output);
+		capture.audio = fopen(path, "w");
+		if (!capture.audio) {
+			return;
+		}
+		fprintf(capture.audio, "%f rate %u\n", game->time, al_get_mixer_frequency(game->audio.music));
+		if (GetDataPackPath()) {
+			fprintf(capture.audio, "%f pack %s\n", game->time, GetDataPackPath());
+		}
+		fprintf(capture.audio, "%f gain master %.9g\n", game->time, al_get_mixer_gain(game->audio.mixer));
+		fprintf(capture.audio, "%f gain music %.9g\n", game->time, al_get_mixer_gain(game->audio.music));
+		fprintf(capture.audio, "%f gain voice %.9g\n", game->time, al_get_mixer_gain(game->audio.voice));
+		fprintf(capture.audio, "%f gain fx %.9g\n", game->time, al_get_mixer_gain(game->audio.fx));
+	}
+	va_list args;
+	va_start(args, format);
+	fprintf(capture.audio, "%f ", game->time);
+	vfprintf(capture.audio, format, args);
+	fprintf(capture.audio, "\n");
+	va_end(args);
+}
+
+void RecordSound(struct Game* game, const char* name, const char* bus, const char* file) {
+	// sounds played straight on the engine's music or fx mixer; "sound <name> stop" ends them
+	if (!capture.active) {
+		return;
+	}
+	char source[1024];
+	GetDataFileSource(game, file, source, sizeof(source));
+	RecordAudioEvent(game, "sound %s %s play %s", name, bus, source);
+}
+
+void FinishCapture(struct Game* game) {
+	if (!capture.active) {
+		return;
+	}
+	if (capture.csv) {
+		fclose(capture.csv);
+		capture.csv = NULL;
+	}
+	if (capture.audio) {
+		RecordAudioEvent(game, "end");
+		fclose(capture.audio);
+		capture.audio = NULL;
+	}
+	capture.finished = true;
+	PrintConsole(game, "Capture: %d frames, %.2f ms/frame average, %.2f ms worst; %d of %d images failed", capture.frames,
+		capture.frames ? capture.total / capture.frames * 1000 : 0, capture.worst * 1000, capture.failed, capture.compared);
+	if (capture.broken) {
+		PrintConsole(game, "Capture: %d other checks failed", capture.broken);
+	}
+	free(capture.steps);
+	capture.steps = NULL;
+}
+
+void FailCapture(struct Game* game, const char* reason) {
+	// main thread only, like the rest of the capture state
+	if (!capture.active) {
+		return;
+	}
+	PrintConsole(game, "Capture: FAILED - %s", reason);
+	capture.broken++;
+}
+
+int GetCaptureExitCode(void) {
+	return capture.active && (capture.failed || capture.broken) ? 1 : 0;
+}
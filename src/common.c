@@ -18,20 +18,93 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#define BLUR_DIVIDER 4.0
-
 #include "common.h"
 #include <libsuperderpy.h>
 
-static unsigned long long int counter;
+static const struct {
+	char* name;
+	float divider; // size of the first blur level relative to the display
+	int levels; // number of targets in the mip chain, each half the size of the previous one
+} QUALITY[] = {
+	{"low", 8.0, 2},
+	{"medium", 4.0, 3},
+	{"high", 2.0, 5},
+};
+
+// dynamic resolution governor
+#define DYNRES_STEP 0.125 // how much the internal resolution changes at once
+#define DYNRES_OVER 1.15 // average frame time above budget * DYNRES_OVER counts as a missed frame
+#define DYNRES_OVER_FRAMES 30 // consecutive missed frames needed to scale down
+#define DYNRES_COOLDOWN 5.0 // seconds within budget before trying to scale back up
+#define DYNRES_COOLDOWN_MAX 60.0
+#define DYNRES_PROBE 1.0 // scaling down this soon after scaling up means the probe failed
+
+// render targets
+#define RESIZE_SETTLE 0.2 // seconds without resize events before reallocating
+
+// shaders
+#define SHADER_WARMUP_DELAY 2 // frames to show before compiling anything, so the window doesn't stay blank
+#define SHADER_COUNT 3
+
+// ghost warp lookup texture
+#define WARP_LUT_SIZE 512
+#define WARP_LUT_HEIGHT 16 // only two rows are needed, but some drivers pad tiny textures
+#define WARP_RANGE 0.008 // largest offset the texture can hold, in texture coordinates
+#define WARP_BENCHMARK_PASSES 30
+
+// post-processing on the CPU
+#define CPUFX_PROBE 3.0 // seconds to measure it for before deciding whether it's faster than shaders
+
+// audio
+#define DSP_REPORT_INTERVAL 10.0 // seconds between DSP timings in debug mode
+
+// text cache
+#define TEXT_CACHE_MARGIN 4 // room around the text for shadows and glyphs reaching past their advance
+
+// static frame detection
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
 
 static void MixerPostprocess(void* buffer, unsigned int samples, void* userdata) {
+	// samples is the number of frames, each holding a value for both channels
 	struct Game* game = userdata;
-	float* buf = buffer;
+	ProcessDspChain(&game->data->dsp.chain, buffer, samples);
+}
 
+static void MasterPostprocess(void* buffer, unsigned int samples, void* userdata) {
+	struct Game* game = userdata;
+	ProcessDspChain(&game->data->dsp.master, buffer, samples);
+}
+
+void UpdateAudio(struct Game* game, double delta) {
+	// the audio thread never looks at the game state directly, only at what gets published here each tick
 	float val = fmaxf(game->data->val, game->data->chime);
-	for (unsigned int i = 0; i < samples; i++) {
-		buf[i] += sinf(fmod(counter++ / (1 + val) * 32 * game->data->tint.r, 2 * ALLEGRO_PI)) * 0.03 * fmin(2.0, val);
+	struct ToneParams params = {
+		.increment = 32 * game->data->tint.r / (1 + val) / (2 * ALLEGRO_PI),
+		.gain = 0.03 * fmin(2.0, val),
+	};
+	if (params.increment != game->data->hum.published.increment || params.gain != game->data->hum.published.gain) {
+		PublishToneParams(&game->data->hum.channel, params);
+		RecordAudioEvent(game, "tone %.9g %.9g", params.increment, params.gain);
+		game->data->hum.published = params;
+	}
+	bool speaking = game->data->narration && al_get_audio_stream_playing(game->data->narration);
+	atomic_store_explicit(&game->data->dsp.duck.active, speaking, memory_order_relaxed);
+	if (game->data->speaking && !speaking) {
+		// the only place that notices a voice line ending, so scripts waiting for it don't have to poll
+		game->data->speaking = false;
+		SignalScripts(game, &game->data->speaking);
+	}
+
+	if (game->config.debug.enabled && game->time - game->data->dsp.reported >= DSP_REPORT_INTERVAL) {
+		char text[512];
+		if (DescribeDspChain(&game->data->dsp.chain, text, sizeof(text))) {
+			PrintConsole(game, "DSP: music %s", text);
+		}
+		if (DescribeDspChain(&game->data->dsp.master, text, sizeof(text))) {
+			PrintConsole(game, "DSP: master %s", text);
+		}
+		game->data->dsp.reported = game->time;
 	}
 }
 
@@ -92,6 +165,7 @@ struct Entity* CreateEntity(struct Game* game, vrWorld* world, float x, float y,
 	vrArrayPush(body->shape, shape);
 
 	struct Entity* entity = calloc(1, sizeof(struct Entity));
+	TrackMemory(game, MEMORY_PHYSICS, ENTITY_FOOTPRINT);
 	entity->body = body;
 	entity->shape = shape;
 	entity->width = w;
@@ -212,6 +286,8 @@ void DrawEntity(struct Game* game, struct Entity* entity) {
 	//vrVec2 topleft = pshape->vertices[0];
 	//PrintConsole(game, "%f %f", topleft.x, topleft.y);
 	if (entity->kind == 2) { return; }
+	AddFrameSignature(game, &entity->kind, sizeof(entity->kind));
+	AddFrameSignature(game, pshape->vertices, sizeof(vrVec2) * pshape->num_vertices);
 	ALLEGRO_COLOR color = entity->kind ? al_map_rgb(255, 255, 255) : al_map_rgb(200, 220, 230);
 
 	if (entity->kind == 3) {
@@ -233,34 +309,225 @@ void DrawEntity(struct Game* game, struct Entity* entity) {
 	al_draw_prim(v, NULL, NULL, 0, 6, ALLEGRO_PRIM_TRIANGLE_LIST);
 }
 
-bool GlobalEventHandler(struct Game* game, ALLEGRO_EVENT* ev) {
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_M)) {
-		ToggleMute(game);
+static bool MeasureTextLine(int line, const char* text, int size, void* extra) {
+	struct CachedText* entry = extra;
+	ALLEGRO_USTR_INFO info;
+	entry->width = fmax(entry->width, al_get_ustr_width(entry->font, al_ref_buffer(&info, text, size)));
+	entry->lines = line + 1;
+	return true;
+}
+
+static bool IsCachedTextUsable(struct CachedText* entry, ALLEGRO_FONT* font, const char* text, float max_width, float line_height, int flags) {
+	if (!entry->bitmap || entry->font != font || entry->flags != flags || strcmp(entry->text, text) != 0) {
+		return false;
+	}
+	if (max_width <= 0 || entry->max_width <= 0) {
+		return max_width <= 0 && entry->max_width <= 0;
 	}
+	if (entry->line_height != line_height) {
+		return false;
+	}
+	// Any wrap width between the widest line and the one it was laid out for breaks the text the same way.
+	// Text that fits on a single line stays that way with any wider limit.
+	return max_width >= entry->width && (max_width <= entry->max_width || entry->lines == 1);
+}
 
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_F)) {
-		ToggleFullscreen(game);
+struct CachedText* CacheText(struct Game* game, ALLEGRO_FONT* font, const char* text, float max_width, float line_height, int flags) {
+	struct CommonResources* data = game->data;
+	struct CachedText* entry = NULL;
+	for (int i = 0; i < TEXT_CACHE_SIZE; i++) {
+		if (IsCachedTextUsable(&data->text_cache[i], font, text, max_width, line_height, flags)) {
+			data->text_cache[i].used = al_get_time();
+			return &data->text_cache[i];
+		}
+		if (!entry || (entry->bitmap && data->text_cache[i].used < entry->used)) {
+			entry = &data->text_cache[i];
+		}
 	}
 
-	if (ev->type == ALLEGRO_EVENT_DISPLAY_RESIZE) {
-		al_destroy_bitmap(game->data->blur1);
-		al_destroy_bitmap(game->data->blur2);
-		al_destroy_bitmap(game->data->buffer);
-		al_destroy_bitmap(game->data->target);
-		al_destroy_bitmap(game->data->tmp);
-		game->data->blur1 = CreateNotPreservedBitmap(ev->display.width / BLUR_DIVIDER, ev->display.height / BLUR_DIVIDER);
-		game->data->blur2 = CreateNotPreservedBitmap(ev->display.width / BLUR_DIVIDER, ev->display.height / BLUR_DIVIDER);
-		game->data->buffer = CreateNotPreservedBitmap(ev->display.width, ev->display.height);
-		game->data->target = CreateNotPreservedBitmap(ev->display.width, ev->display.height);
-		game->data->tmp = CreateNotPreservedBitmap(ev->display.width, ev->display.height);
+	// not there yet, so render it into the least recently used slot
+	if (entry->bitmap) {
+		DestroyTrackedBitmap(game, MEMORY_BITMAPS, entry->bitmap);
+		free(entry->text);
+	}
+	*entry = (struct CachedText){.text = strdup(text), .font = font, .flags = flags, .max_width = max_width, .line_height = line_height, .lines = 1, .used = al_get_time()};
+	if (max_width > 0) {
+		al_do_multiline_text(font, max_width, text, MeasureTextLine, entry);
+	} else {
+		entry->width = al_get_text_width(font, text);
 	}
 
-	return false;
+	int align = flags & (ALLEGRO_ALIGN_CENTER | ALLEGRO_ALIGN_RIGHT);
+	entry->anchor = TEXT_CACHE_MARGIN + (align == ALLEGRO_ALIGN_RIGHT ? entry->width : (align == ALLEGRO_ALIGN_CENTER ? entry->width / 2.0 : 0));
+	int height = (entry->lines - 1) * line_height + al_get_font_line_height(font);
+
+	ALLEGRO_STATE state;
+	al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP | ALLEGRO_STATE_NEW_BITMAP_PARAMETERS | ALLEGRO_STATE_BLENDER);
+	al_set_new_bitmap_flags(al_get_new_bitmap_flags() & ~ALLEGRO_MEMORY_BITMAP);
+	entry->bitmap = TrackBitmap(game, MEMORY_BITMAPS, al_create_bitmap(ceil(entry->width) + TEXT_CACHE_MARGIN * 2, height + TEXT_CACHE_MARGIN * 2));
+	al_set_target_bitmap(entry->bitmap);
+	al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+	al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_INVERSE_ALPHA);
+	// white, so any color can be applied when drawing
+	if (max_width > 0) {
+		al_draw_multiline_text(font, al_map_rgb(255, 255, 255), entry->anchor, TEXT_CACHE_MARGIN, max_width, line_height, align, text);
+	} else if (flags & TEXT_SHADOW) {
+		DrawTextWithShadow(font, al_map_rgb(255, 255, 255), entry->anchor, TEXT_CACHE_MARGIN, align, text);
+	} else {
+		al_draw_text(font, al_map_rgb(255, 255, 255), entry->anchor, TEXT_CACHE_MARGIN, align, text);
+	}
+	al_restore_state(&state);
+
+	if (game->config.debug.verbose) {
+		PrintConsole(game, "Text cache: rendered \"%s\" (%dx%d)", text, al_get_bitmap_width(entry->bitmap), al_get_bitmap_height(entry->bitmap));
+	}
+	return entry;
 }
 
-void Compositor(struct Game* game) {
-	al_set_target_bitmap(game->data->target);
+void DrawCachedText(struct Game* game, struct CachedText* text, ALLEGRO_COLOR color, float x, float y) {
+	al_draw_tinted_bitmap(text->bitmap, color, roundf(x - text->anchor), roundf(y - TEXT_CACHE_MARGIN), 0);
+}
+
+void ClearTextCache(struct Game* game, ALLEGRO_FONT* font) {
+	// has to be called before destroying a font, as another one could end up at the same address
+	for (int i = 0; i < TEXT_CACHE_SIZE; i++) {
+		struct CachedText* entry = &game->data->text_cache[i];
+		if (entry->bitmap && (!font || entry->font == font)) {
+			DestroyTrackedBitmap(game, MEMORY_BITMAPS, entry->bitmap);
+			free(entry->text);
+			*entry = (struct CachedText){0};
+		}
+	}
+}
+
+void WarmupGlyphs(struct Game* game, ALLEGRO_FONT* font, const char* name, const char* const* texts) {
+	// TTF glyphs get rasterized into the font's texture sheets the first time they're drawn,
+	// so draw each one used by the given NULL-terminated list of texts once during loading
+	double start = al_get_time();
+	int32_t* codepoints = NULL;
+	int count = 0;
+	size_t memory = 0;
+
+	ALLEGRO_STATE state;
+	al_store_state(&state, ALLEGRO_STATE_TARGET_BITMAP);
+	ALLEGRO_BITMAP* scratch = CreateNotPreservedBitmap(1, 1);
+	al_set_target_bitmap(scratch);
+
+	for (int i = 0; texts[i]; i++) {
+		ALLEGRO_USTR_INFO info;
+		const ALLEGRO_USTR* text = al_ref_cstr(&info, texts[i]);
+		int pos = 0;
+		int32_t c;
+		while ((c = al_ustr_get_next(text, &pos)) >= 0) {
+			bool seen = false;
+			for (int j = 0; j < count && !seen; j++) {
+				seen = codepoints[j] == c;
+			}
+			if (seen) {
+				continue;
+			}
+			codepoints = realloc(codepoints, sizeof(int32_t) * (count + 1));
+			codepoints[count++] = c;
+
+			al_draw_glyph(font, al_map_rgb(255, 255, 255), 0, 0, c);
+			int x, y, w, h;
+			if (al_get_glyph_dimensions(font, c, &x, &y, &w, &h)) {
+				memory += (w + 2) * (h + 2) * 4; // with the padding the addon leaves around each glyph
+			}
+		}
+	}
+
+	al_destroy_bitmap(scratch);
+	al_restore_state(&state);
+	free(codepoints);
+	PrintConsole(game, "Glyph cache: %s warmed up with %d glyphs (~%.1f KB) in %.2f ms", name, count, memory / 1024.0, (al_get_time() - start) * 1000);
+}
+
+void AddFrameSignature(struct Game* game, const void* state, size_t size) {
+	// FNV-1a over everything a gamestate put into its framebuffer this frame
+	const unsigned char* bytes = state;
+	for (size_t i = 0; i < size; i++) {
+		game->data->frame.hash = (game->data->frame.hash ^ bytes[i]) * FNV_PRIME;
+	}
+}
+
+void SubmitFrameSignature(struct Game* game) {
+	game->data->frame.reports++;
+}
+
+static bool IsFrameStatic(struct Game* game) {
+	struct CommonResources* data = game->data;
+
+	// gamestates that don't report their signature are assumed to change every frame
+	int visible = game->loading.shown ? 1 : 0;
+	struct Gamestate* tmp = GetNextGamestate(game, NULL);
+	while (tmp) {
+		if (IsGamestateVisible(game, tmp)) {
+			visible++;
+		}
+		tmp = GetNextGamestate(game, tmp);
+	}
+
+	AddFrameSignature(game, &data->hud, sizeof(data->hud));
+	AddFrameSignature(game, &data->tint, sizeof(data->tint));
+
+	bool unchanged = data->frame.reuse && !game->loading.shown && data->frame.reports >= visible && data->frame.hash == data->frame.last;
+
+	data->frame.last = data->frame.hash;
+	data->frame.hash = FNV_OFFSET;
+	data->frame.reports = 0;
+	data->frame.static_frames = unchanged ? data->frame.static_frames + 1 : 0;
+	return unchanged;
+}
+
+static void LoadQualitySettings(struct Game* game, struct CommonResources* data) {
+	const char* quality = GetConfigOptionDefault(game, "Bob", "quality", "medium");
+	int tier = 1;
+	for (size_t i = 0; i < sizeof(QUALITY) / sizeof(QUALITY[0]); i++) {
+		if (strcmp(quality, QUALITY[i].name) == 0) {
+			tier = i;
+		}
+	}
+	data->blur_divider = QUALITY[tier].divider;
+	data->blur_levels = QUALITY[tier].levels;
+	PrintConsole(game, "Quality: %s (blur divider %.0f, %d levels)", QUALITY[tier].name, data->blur_divider, data->blur_levels);
+}
+
+static void LoadDynamicResolutionSettings(struct Game* game, struct CommonResources* data) {
+	data->dynres.enabled = strtol(GetConfigOptionDefault(game, "Bob", "dynamic_resolution", "1"), NULL, 10);
+	data->dynres.budget = 1.0 / fmax(1, strtod(GetConfigOptionDefault(game, "Bob", "target_fps", "60"), NULL));
+	data->dynres.min = fmin(1.0, fmax(DYNRES_STEP, strtod(GetConfigOptionDefault(game, "Bob", "min_scale", "0.5"), NULL)));
+	data->dynres.max = fmin(1.0, fmax(data->dynres.min, strtod(GetConfigOptionDefault(game, "Bob", "max_scale", "1.0"), NULL)));
+	data->dynres.scale = data->dynres.max;
+	data->dynres.average = data->dynres.budget;
+	data->dynres.cooldown = DYNRES_COOLDOWN;
+}
+
+static void DrawFeedback(struct Game* game, struct RenderPass* pass, ALLEGRO_BITMAP* inputs[], ALLEGRO_BITMAP* output) {
+	float scale = al_get_bitmap_height(output) / (float)al_get_display_height(game->display);
+	ClearToColor(game, al_map_rgba(0, 0, 0, 0));
+	al_draw_tinted_bitmap(inputs[0], game->data->tint, 0, -game->clip_rect.h * 0.003 * scale, 0);
+}
+
+static void DrawDualFilter(struct Game* game, struct RenderPass* pass, ALLEGRO_BITMAP* inputs[], ALLEGRO_BITMAP* output) {
+	float size[2];
+	GetTextureSize(inputs[0], size);
+	float halfpixel[2] = {0.5 / size[0], 0.5 / size[1]};
+
+	al_clear_to_color(al_map_rgb(0, 0, 0));
+	al_set_shader_float_vector("halfpixel", 2, halfpixel, 1);
+	al_set_shader_bool("up", pass->arg);
+	al_draw_scaled_bitmap(inputs[0], 0, 0, al_get_bitmap_width(inputs[0]), al_get_bitmap_height(inputs[0]), 0, 0, al_get_bitmap_width(output), al_get_bitmap_height(output), 0);
+}
+
+static void DrawScene(struct Game* game, struct RenderPass* pass, ALLEGRO_BITMAP* inputs[], ALLEGRO_BITMAP* output) {
+	ALLEGRO_TRANSFORM transform;
+
 	ClearToColor(game, al_map_rgba(0, 0, 0, 0));
+	al_identity_transform(&transform);
+	al_scale_transform(&transform, al_get_bitmap_width(output) / (float)al_get_display_width(game->display),
+		al_get_bitmap_height(output) / (float)al_get_display_height(game->display));
+	al_use_transform(&transform);
 
 	struct Gamestate* tmp = GetNextGamestate(game, NULL);
 	while (tmp) {
@@ -275,111 +542,503 @@ void Compositor(struct Game* game) {
 
 	DrawHUD(game);
 
-	al_set_target_bitmap(game->data->tmp);
-	ClearToColor(game, al_map_rgba(0, 0, 0, 0));
-	al_draw_tinted_bitmap(game->data->buffer, game->data->tint, 0, -game->clip_rect.h * 0.003, 0);
+	al_identity_transform(&transform);
+	al_use_transform(&transform);
+}
 
-	float size[2] = {al_get_bitmap_width(game->data->tmp), al_get_bitmap_height(game->data->tmp)};
+static void DrawOverlayLayer(struct Game* game, ALLEGRO_BITMAP* output) {
+	if (!game->data->overlay.draw) {
+		return;
+	}
+	// the same place the gamestate's framebuffer got drawn to
+	ALLEGRO_TRANSFORM transform;
+	al_identity_transform(&transform);
+	al_scale_transform(&transform, game->clip_rect.w / (float)game->viewport.width, game->clip_rect.h / (float)game->viewport.height);
+	al_translate_transform(&transform, game->clip_rect.x, game->clip_rect.y);
+	al_scale_transform(&transform, al_get_bitmap_width(output) / (float)al_get_display_width(game->display),
+		al_get_bitmap_height(output) / (float)al_get_display_height(game->display));
+	al_use_transform(&transform);
+	game->data->overlay.draw(game, game->data->overlay.data);
 
-	al_set_target_bitmap(game->data->blur1);
-	al_clear_to_color(al_map_rgb(0, 0, 0));
-	al_use_shader(game->data->kawese_shader);
-	al_clear_to_color(al_map_rgb(0, 0, 0));
-	al_set_shader_float_vector("size", 2, size, 1);
-	al_set_shader_float("kernel", 0);
-	al_draw_scaled_bitmap(game->data->tmp, 0, 0, size[0], size[1], 0, 0, size[0] / BLUR_DIVIDER, size[1] / BLUR_DIVIDER, 0);
-	al_use_shader(NULL);
+	al_identity_transform(&transform);
+	al_use_transform(&transform);
+}
 
-	al_set_target_bitmap(game->data->blur2);
-	al_clear_to_color(al_map_rgb(0, 0, 0));
-	al_use_shader(game->data->kawese_shader);
-	al_set_shader_float_vector("size", 2, size, 1);
-	al_set_shader_float("kernel", 1);
-	al_draw_bitmap(game->data->blur1, 0, 0, 0);
-	al_use_shader(NULL);
+static void DrawOverlay(struct Game* game, struct RenderPass* pass, ALLEGRO_BITMAP* inputs[], ALLEGRO_BITMAP* output) {
+	// the scene may be the one composed frames ago, so whatever keeps moving on it gets added here
+	al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+	al_draw_bitmap(inputs[0], 0, 0, 0);
+	DrawOverlayLayer(game, output);
+}
+
+static void DrawUnprocessed(struct Game* game) {
+	// what the frame looks like before any post-processing, for as long as it can't be done properly
+	ALLEGRO_BITMAP* backbuffer = al_get_backbuffer(game->display);
+	al_set_target_backbuffer(game->display);
+	DrawScene(game, NULL, NULL, backbuffer);
+	DrawOverlayLayer(game, backbuffer);
+}
+
+static unsigned char EncodeWarp(float offset) {
+	return fmin(255, fmax(0, (offset / WARP_RANGE * 0.5 + 0.5) * 255 + 0.5));
+}
+
+static void UpdateWarp(struct Game* game) {
+	// The ghost warp is a sum of sines of either uv.x or uv.y, so it only has to be evaluated
+	// along the edges. The top half of the texture holds the uv.x term, the bottom half both uv.y ones.
+	if (game->data->warp.time == game->time) {
+		return;
+	}
+	game->data->warp.time = game->time;
+
+	ALLEGRO_LOCKED_REGION* region = al_lock_bitmap(game->data->warp.lut, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_WRITEONLY);
+	if (!region) {
+		return;
+	}
+	float t = game->time / 16.0;
+	for (int i = 0; i < WARP_LUT_SIZE; i++) {
+		float v = (i + 0.5) / WARP_LUT_SIZE;
+		unsigned char columns[4] = {EncodeWarp((0.2 * sin((v + t) * 10.0) * 0.05 + 0.2 * sin((v + t) * 30.0) * 0.02) / 8.0), 0, 0, 255};
+		unsigned char rows[4] = {EncodeWarp((0.7 * sin((v + t) * 4.0) * 0.038 + 0.3 * sin((v + t) * 8.0) * 0.010 + 0.05 * sin((v + t) * 40.0) * 0.05) / 8.0),
+			EncodeWarp(0.5 * sin((v + t) * 5.0) * 0.1 / 8.0), 0, 255};
+		for (int y = 0; y < WARP_LUT_HEIGHT; y++) {
+			memcpy((unsigned char*)region->data + y * region->pitch + i * 4, y < WARP_LUT_HEIGHT / 2 ? columns : rows, 4);
+		}
+	}
+	al_unlock_bitmap(game->data->warp.lut);
+}
+
+static void DrawGhost(struct Game* game, struct RenderPass* pass, ALLEGRO_BITMAP* inputs[], ALLEGRO_BITMAP* output) {
+	ALLEGRO_BITMAP* glow = inputs[0];
 
-	al_set_target_bitmap(game->data->buffer);
 	ClearToColor(game, al_map_rgba(0, 0, 0, 0));
 
-	al_use_shader(game->data->ghost_shader);
+	if (game->data->warp.enabled) {
+		UpdateWarp(game);
+		al_set_shader_sampler("warp", game->data->warp.lut, 2);
+		al_set_shader_float("warp_range", WARP_RANGE);
+	}
+	al_set_shader_bool("lut", game->data->warp.enabled);
 	al_set_shader_bool("invert", false);
 	al_set_shader_float("time", game->time);
 	al_set_shader_sampler("displacement", game->data->displacement, 1);
-	float vertices[4] = {0.0, 0.0, al_get_bitmap_width(game->data->blur2), al_get_bitmap_height(game->data->blur2)};
+	float vertices[4] = {0.0, 0.0, al_get_bitmap_width(glow), al_get_bitmap_height(glow)};
 	al_set_shader_float_vector("vertices", 4, vertices, 1);
 
-	float tex_whole_pixel_size[2] = {al_get_bitmap_width(game->data->blur2), al_get_bitmap_height(game->data->blur2)};
+	float tex_whole_pixel_size[2];
+	GetTextureSize(glow, tex_whole_pixel_size);
 	al_set_shader_float_vector("tex_whole_pixel_size", 2, tex_whole_pixel_size, 1);
 
-	float tex_boundaries[4] = {(al_get_bitmap_x(game->data->blur2) - 1) / tex_whole_pixel_size[0],
-		1.0 - ((al_get_bitmap_y(game->data->blur2) + al_get_bitmap_height(game->data->blur2) + 1) / tex_whole_pixel_size[1]),
-		(al_get_bitmap_x(game->data->blur2) + al_get_bitmap_width(game->data->blur2) + 1) / tex_whole_pixel_size[0],
-		1.0 - ((al_get_bitmap_y(game->data->blur2) - 1) / tex_whole_pixel_size[1])};
+	float region[4];
+	GetTextureRegion(glow, region);
+	al_set_shader_float_vector("region", 4, region, 1);
+
+	float tex_boundaries[4] = {(al_get_bitmap_x(glow) - 1) / tex_whole_pixel_size[0],
+		1.0 - ((al_get_bitmap_y(glow) + al_get_bitmap_height(glow) + 1) / tex_whole_pixel_size[1]),
+		(al_get_bitmap_x(glow) + al_get_bitmap_width(glow) + 1) / tex_whole_pixel_size[0],
+		1.0 - ((al_get_bitmap_y(glow) - 1) / tex_whole_pixel_size[1])};
 	al_set_shader_float_vector("tex_boundaries", 4, tex_boundaries, 1);
 
 	al_set_shader_float("zoom", 1.0);
 
 	al_set_shader_bool("inplace", false);
 	al_set_shader_bool("active", false);
-	al_draw_tinted_scaled_bitmap(game->data->blur2, al_map_rgba_f(1, 1, 1, 1), 0, 0, size[0] / BLUR_DIVIDER, size[1] / BLUR_DIVIDER, 0, 0, size[0], size[1], 0);
-	al_use_shader(NULL);
+	al_draw_tinted_scaled_bitmap(glow, al_map_rgba_f(1, 1, 1, 1), 0, 0, al_get_bitmap_width(glow), al_get_bitmap_height(glow), 0, 0, al_get_bitmap_width(output), al_get_bitmap_height(output), 0);
+}
 
-	al_use_shader(game->data->dis_shader);
+static void DrawDisplaced(struct Game* game, struct RenderPass* pass, ALLEGRO_BITMAP* inputs[], ALLEGRO_BITMAP* output) {
+	ALLEGRO_BITMAP *target = inputs[0], *glow = inputs[1];
+
+	float region[4];
+	GetTextureRegion(target, region);
 	al_set_shader_sampler("displacement", game->data->displacement, 1);
-	al_draw_bitmap(game->data->target, 0, 0, 0);
+	al_set_shader_float_vector("region", 4, region, 1);
+	al_draw_bitmap(target, 0, 0, 0);
 	al_use_shader(NULL);
-	al_draw_tinted_scaled_bitmap(game->data->blur2, al_map_rgba_f(0.5, 0.5, 0.5, 0.5), 0, 0, size[0] / BLUR_DIVIDER, size[1] / BLUR_DIVIDER, 0, 0, size[0], size[1], 0);
+	al_draw_tinted_scaled_bitmap(glow, al_map_rgba_f(0.5, 0.5, 0.5, 0.5), 0, 0, al_get_bitmap_width(glow), al_get_bitmap_height(glow), 0, 0, al_get_bitmap_width(output), al_get_bitmap_height(output), 0);
+}
 
-	al_set_target_backbuffer(game->display);
+static void DrawPresent(struct Game* game, struct RenderPass* pass, ALLEGRO_BITMAP* inputs[], ALLEGRO_BITMAP* output) {
 	ClearToColor(game, al_map_rgb(0, 0, 0));
-	al_draw_bitmap(game->data->buffer, 0, 0, 0);
+	al_draw_scaled_bitmap(inputs[0], 0, 0, al_get_bitmap_width(inputs[0]), al_get_bitmap_height(inputs[0]),
+		0, 0, al_get_display_width(game->display), al_get_display_height(game->display), 0);
+}
+
+static void CreateRenderTargets(struct Game* game, struct CommonResources* data, int width, int height) {
+	struct RenderGraph* graph = &data->graph;
+	data->width = width;
+	data->height = height;
+
+	// everything up to the final pass is rendered at the internal resolution...
+	int w = fmax(1, width * data->dynres.scale), h = fmax(1, height * data->dynres.scale);
+	int buffer = AddRenderResource(graph, "buffer", w, h);
+	int tmp = AddRenderResource(graph, "tmp", w, h);
+	int target = AddRenderResource(graph, "target", w, h);
+	int layered = AddRenderResource(graph, "layered", w, h);
+
+	// ...while the glow keeps its on-screen size, as it's cheap anyway and would get blockier otherwise
+	int blur[BLUR_MAX_LEVELS];
+	float divider = fmax(1.0, data->blur_divider * data->dynres.scale);
+	float bw = w / divider, bh = h / divider;
+	for (int i = 0; i < data->blur_levels; i++) {
+		blur[i] = AddRenderResource(graph, "blur", bw, bh);
+		bw /= 2.0;
+		bh /= 2.0;
+	}
+
+	// The glow only depends on the previous frame, so it goes first. On static frames the whole chain gets
+	// skipped, so only its result has to be kept; tmp and the inner mip levels share bitmaps within the frame.
+	data->passes.blur = AddRenderPass(graph, (struct RenderPass){.name = "feedback", .inputs = {buffer}, .input_count = 1, .output = tmp, .draw = DrawFeedback, .cpu = CpuFeedback});
+	// dual filter: walk down the mip chain, then back up into its first level
+	AddRenderPass(graph, (struct RenderPass){.name = "downsample", .reusable = data->blur_levels == 1, .inputs = {tmp}, .input_count = 1, .output = blur[0], .shader = &data->blur_shader, .draw = DrawDualFilter, .cpu = CpuDualFilter});
+	for (int i = 1; i < data->blur_levels; i++) {
+		AddRenderPass(graph, (struct RenderPass){.name = "downsample", .inputs = {blur[i - 1]}, .input_count = 1, .output = blur[i], .shader = &data->blur_shader, .draw = DrawDualFilter, .cpu = CpuDualFilter});
+	}
+	for (int i = data->blur_levels - 1; i > 0; i--) {
+		AddRenderPass(graph, (struct RenderPass){.name = "upsample", .reusable = i == 1, .inputs = {blur[i]}, .input_count = 1, .output = blur[i - 1], .shader = &data->blur_shader, .arg = true, .draw = DrawDualFilter, .cpu = CpuDualFilter});
+	}
+	data->passes.blur_count = graph->pass_count - data->passes.blur;
+
+	data->passes.scene = AddRenderPass(graph, (struct RenderPass){.name = "scene", .reusable = true, .output = target, .draw = DrawScene});
+	AddRenderPass(graph, (struct RenderPass){.name = "overlay", .inputs = {target}, .input_count = 1, .output = layered, .draw = DrawOverlay});
+	data->passes.ghost = AddRenderPass(graph, (struct RenderPass){.name = "ghost", .inputs = {blur[0]}, .input_count = 1, .output = buffer, .shader = &data->ghost_shader, .draw = DrawGhost, .cpu = CpuGhost});
+	AddRenderPass(graph, (struct RenderPass){.name = "displace", .inputs = {layered, blur[0]}, .input_count = 2, .output = buffer, .shader = &data->dis_shader, .draw = DrawDisplaced, .cpu = CpuDisplaced});
+	AddRenderPass(graph, (struct RenderPass){.name = "present", .inputs = {buffer}, .input_count = 1, .output = RENDER_GRAPH_BACKBUFFER, .draw = DrawPresent});
+
+	CompileRenderGraph(game, graph);
+	al_set_target_backbuffer(game->display);
+
+	data->frame.static_frames = 0;
+	data->resize.pending = false;
+}
+
+static void DestroyRenderTargets(struct Game* game, struct CommonResources* data) {
+	DestroyRenderGraph(game, &data->graph);
+}
+
+static void SetRenderScale(struct Game* game, float scale) {
+	if (scale == game->data->dynres.scale) {
+		return;
+	}
+	PrintConsole(game, "Dynamic resolution: %d%% -> %d%% (%.2f ms/frame)", (int)(game->data->dynres.scale * 100), (int)(scale * 100), game->data->dynres.average * 1000);
+	game->data->dynres.scale = scale;
+	DestroyRenderTargets(game, game->data);
+	CreateRenderTargets(game, game->data, game->data->width, game->data->height);
+}
+
+static void UpdateDynamicResolution(struct Game* game) {
+	struct CommonResources* data = game->data;
+	double now = al_get_time();
+	double frametime = now - data->dynres.last;
+	data->dynres.last = now;
+
+	if (!data->dynres.enabled || frametime > 0.25) {
+		// loading screens and other hiccups aren't representative
+		return;
+	}
+
+	data->dynres.average = data->dynres.average * 0.9 + frametime * 0.1;
+	data->dynres.stable += frametime;
+	data->dynres.probe += frametime;
+
+	if (data->dynres.average > data->dynres.budget * DYNRES_OVER) {
+		data->dynres.over++;
+		data->dynres.stable = 0;
+	} else {
+		data->dynres.over = 0;
+	}
+
+	if (data->dynres.over >= DYNRES_OVER_FRAMES && data->dynres.scale > data->dynres.min) {
+		if (data->dynres.probe < DYNRES_PROBE) {
+			// we've just gone up and it didn't work out, so wait longer before the next try
+			data->dynres.cooldown = fmin(DYNRES_COOLDOWN_MAX, data->dynres.cooldown * 2);
+		}
+		data->dynres.over = 0;
+		SetRenderScale(game, fmax(data->dynres.min, data->dynres.scale - DYNRES_STEP));
+		return;
+	}
+
+	if (data->dynres.stable >= data->dynres.cooldown && data->dynres.scale < data->dynres.max) {
+		if (data->dynres.probe >= DYNRES_PROBE) {
+			data->dynres.cooldown = DYNRES_COOLDOWN;
+		}
+		data->dynres.stable = 0;
+		data->dynres.probe = 0;
+		SetRenderScale(game, fmin(data->dynres.max, data->dynres.scale + DYNRES_STEP));
+	}
+}
+
+static void LoadPostprocessingSettings(struct Game* game, struct CommonResources* data) {
+	const char* cpu = GetConfigOptionDefault(game, "Bob", "cpu_postprocessing", "auto");
+	data->cpufx.automatic = strcmp(cpu, "auto") == 0;
+	data->graph.cpu = strcmp(cpu, "1") == 0;
+	if (data->graph.cpu) {
+		data->cpufx.workers = CreateCpuWorkers(game);
+	}
+
+	data->warp.enabled = strcmp(GetConfigOptionDefault(game, "Bob", "ghost_warp", "lut"), "lut") == 0;
+	int flags = al_get_new_bitmap_flags();
+	al_set_new_bitmap_flags((flags & ~ALLEGRO_MEMORY_BITMAP) | ALLEGRO_MIN_LINEAR | ALLEGRO_MAG_LINEAR);
+	data->warp.lut = TrackBitmap(game, MEMORY_BITMAPS, al_create_bitmap(WARP_LUT_SIZE, WARP_LUT_HEIGHT));
+	al_set_new_bitmap_flags(flags);
+	data->warp.time = -1;
+}
+
+static double TimeGhostPass(struct Game* game, struct RenderPass* pass, ALLEGRO_BITMAP* glow, ALLEGRO_BITMAP* output, bool lut) {
+	game->data->warp.enabled = lut;
+	double start = al_get_time();
+	for (int i = 0; i < WARP_BENCHMARK_PASSES; i++) {
+		al_set_target_bitmap(output);
+		al_use_shader(game->data->ghost_shader);
+		DrawGhost(game, pass, &glow, output);
+		al_use_shader(NULL);
+	}
+	// reading back waits for the GPU to actually finish
+	if (al_lock_bitmap_region(output, 0, 0, 1, 1, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY)) {
+		al_unlock_bitmap(output);
+	}
+	return (al_get_time() - start) / WARP_BENCHMARK_PASSES;
+}
+
+static void BenchmarkGhostWarp(struct Game* game) {
+	// compares the lookup texture against evaluating the sines per pixel, in speed and in the image it gives
+	struct CommonResources* data = game->data;
+	struct RenderPass* pass = &data->graph.passes[data->passes.ghost];
+	ALLEGRO_BITMAP* glow = data->graph.resources[pass->inputs[0]].view;
+	int w = data->graph.resources[pass->output].width, h = data->graph.resources[pass->output].height;
+	bool enabled = data->warp.enabled;
+
+	ALLEGRO_BITMAP* exact = CreateNotPreservedBitmap(w, h);
+	ALLEGRO_BITMAP* lut = CreateNotPreservedBitmap(w, h);
+	double exact_time = TimeGhostPass(game, pass, glow, exact, false);
+	double lut_time = TimeGhostPass(game, pass, glow, lut, true);
+	data->warp.enabled = enabled;
+
+	ALLEGRO_LOCKED_REGION* a = al_lock_bitmap(exact, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY);
+	ALLEGRO_LOCKED_REGION* b = al_lock_bitmap(lut, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY);
+	int worst = 0;
+	double squared = 0;
+	for (int y = 0; a && b && y < h; y++) {
+		const unsigned char* pa = (const unsigned char*)a->data + y * a->pitch;
+		const unsigned char* pb = (const unsigned char*)b->data + y * b->pitch;
+		for (int x = 0; x < w * 4; x++) {
+			int diff = abs(pa[x] - pb[x]);
+			worst = diff > worst ? diff : worst;
+			squared += diff * diff;
+		}
+	}
+	if (a) {
+		al_unlock_bitmap(exact);
+	}
+	if (b) {
+		al_unlock_bitmap(lut);
+	}
+	al_destroy_bitmap(exact);
+	al_destroy_bitmap(lut);
+	al_set_target_backbuffer(game->display);
+
+	double mse = squared / (w * h * 4.0);
+	PrintConsole(game, "Ghost warp at %dx%d: per pixel %.3f ms (%.0f Mpix/s), lookup texture %.3f ms (%.0f Mpix/s); max error %d, PSNR %.1f dB",
+		w, h, exact_time * 1000, w * h / exact_time / 1e6, lut_time * 1000, w * h / lut_time / 1e6, worst, mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : INFINITY);
+}
+
+static void WarmupShaders(struct Game* game) {
+	// Shaders get built one per frame once the intro is on screen, instead of blocking the launch.
+	// Until all of them are there, frames go out without post-processing. Repeated launches are mostly
+	// sped up by the driver's own on-disk shader cache, as Allegro offers no way to load program binaries.
+	struct CommonResources* data = game->data;
+	ALLEGRO_SHADER** shaders[SHADER_COUNT] = {&data->blur_shader, &data->ghost_shader, &data->dis_shader};
+	const char* sources[SHADER_COUNT] = {"shaders/dualfilter.glsl", "shaders/ghosttree.glsl", "shaders/dis.glsl"};
+
+	if (data->warmup.built == SHADER_COUNT || data->warmup.frames++ < SHADER_WARMUP_DELAY) {
+		return;
+	}
+
+	double start = al_get_time();
+	*shaders[data->warmup.built] = CreateShader(game, GetDataFilePath(game, "shaders/vertex.glsl"), GetDataFilePath(game, sources[data->warmup.built]));
+	PrintConsole(game, "Shader %s built in %.1f ms", sources[data->warmup.built], (al_get_time() - start) * 1000);
+	data->warmup.built++;
+
+	if (data->warmup.built == SHADER_COUNT && data->ghost_shader && game->config.debug.enabled) {
+		BenchmarkGhostWarp(game);
+	}
+
+	if (data->warmup.built == SHADER_COUNT && data->cpufx.automatic && !(data->blur_shader && data->ghost_shader && data->dis_shader)) {
+		PrintConsole(game, "Shaders unavailable, post-processing on the CPU");
+		if (!data->cpufx.workers) {
+			data->cpufx.workers = CreateCpuWorkers(game);
+		}
+		data->graph.cpu = true;
+	}
+}
+
+static void UpdatePostprocessing(struct Game* game) {
+	struct CommonResources* data = game->data;
+	if (!data->cpufx.automatic || IsCapturing()) {
+		return;
+	}
+
+	if (!data->cpufx.tried && data->dynres.scale <= data->dynres.min && data->dynres.over >= DYNRES_OVER_FRAMES) {
+		// the governor has nowhere left to go and shaders still don't make it, so see whether the CPU does better
+		PrintConsole(game, "Shaders too slow (%.2f ms/frame at %d%%), trying post-processing on the CPU", data->dynres.average * 1000, (int)(data->dynres.scale * 100));
+		if (!data->cpufx.workers) {
+			data->cpufx.workers = CreateCpuWorkers(game);
+		}
+		data->cpufx.gpu = data->dynres.average;
+		data->cpufx.started = al_get_time();
+		data->cpufx.tried = true;
+		data->cpufx.probing = true;
+		data->graph.cpu = true;
+		return;
+	}
+
+	if (data->cpufx.probing && al_get_time() - data->cpufx.started >= CPUFX_PROBE) {
+		data->cpufx.probing = false;
+		data->graph.cpu = data->dynres.average < data->cpufx.gpu;
+		PrintConsole(game, "Post-processing: %.2f ms/frame on the CPU, %.2f ms/frame with shaders, staying on the %s", data->dynres.average * 1000,
+			data->cpufx.gpu * 1000, data->graph.cpu ? "CPU" : "GPU");
+	}
+}
+
+void SetNarration(struct Game* game, ALLEGRO_AUDIO_STREAM* stream) {
+	game->data->narration = stream;
+	game->data->speaking = stream && al_get_audio_stream_playing(stream);
+	SignalScripts(game, &game->data->speaking);
+}
+
+void GlobalPostLogic(struct Game* game, double delta) {
+	UpdateAudio(game, GetLogicDelta(delta));
+	UpdatePreloads(game);
+	ReportMemoryBudgets(game);
+}
+
+bool GlobalEventHandler(struct Game* game, ALLEGRO_EVENT* ev) {
+	TranslateCaptureEvent(game, ev);
+	NoteFramePacingEvent(game, ev);
+
+	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_M)) {
+		ToggleMute(game);
+	}
+
+	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_F)) {
+		ToggleFullscreen(game);
+	}
+
+	if (ev->type == ALLEGRO_EVENT_DISPLAY_RESIZE) {
+		// dragging a window edge fires lots of these, so reallocate only once the size settles
+		game->data->resize.pending = true;
+		game->data->resize.time = al_get_time();
+	}
+
+	return false;
+}
+
+void Compositor(struct Game* game) {
+	struct CommonResources* data = game->data;
+	double start = al_get_time();
+
+	if (data->resize.pending && al_get_time() - data->resize.time >= RESIZE_SETTLE) {
+		DestroyRenderTargets(game, data);
+		CreateRenderTargets(game, data, al_get_display_width(game->display), al_get_display_height(game->display));
+	}
+	TrimRenderTargetPool(game);
+
+	UpdateDynamicResolution(game);
+	UpdatePostprocessing(game);
+
+	// When nothing changed since the last frame, the scene composition can be reused as it is.
+	// The blur feeds back on the previous output though, so it's frozen only once it had time to settle.
+	// The ghost pass animates with time, so it's redone every frame regardless.
+	data->graph.passes[data->passes.scene].reuse = IsFrameStatic(game);
+	for (int i = 0; i < data->passes.blur_count; i++) {
+		data->graph.passes[data->passes.blur + i].reuse = data->frame.static_frames >= STATIC_SETTLE_FRAMES;
+	}
+
+	if (data->warmup.built < SHADER_COUNT && !data->graph.cpu) {
+		// the passes would come out wrong without their shaders, so the intro starts out plain instead
+		DrawUnprocessed(game);
+	} else {
+		ExecuteRenderGraph(game, &data->graph);
+	}
+	FinishLatencyFrame(game);
+	CaptureFrame(game, start);
+	WarmupShaders(game);
+	PaceFrame(game, start);
 }
 
 struct CommonResources* CreateGameData(struct Game* game) {
 	struct CommonResources* data = calloc(1, sizeof(struct CommonResources));
-	data->blur1 = CreateNotPreservedBitmap(al_get_display_width(game->display) / BLUR_DIVIDER, al_get_display_height(game->display) / BLUR_DIVIDER);
-	data->blur2 = CreateNotPreservedBitmap(al_get_display_width(game->display) / BLUR_DIVIDER, al_get_display_height(game->display) / BLUR_DIVIDER);
-	data->buffer = CreateNotPreservedBitmap(al_get_display_width(game->display), al_get_display_height(game->display));
-	data->target = CreateNotPreservedBitmap(al_get_display_width(game->display), al_get_display_height(game->display));
-	data->tmp = CreateNotPreservedBitmap(al_get_display_width(game->display), al_get_display_height(game->display));
-	data->font = al_load_font(GetDataFilePath(game, "fonts/Roboto-Condensed.ttf"), 58, 0);
-	data->kawese_shader = CreateShader(game, GetDataFilePath(game, "shaders/vertex.glsl"), GetDataFilePath(game, "shaders/kawese.glsl"));
-	data->ghost_shader = CreateShader(game, GetDataFilePath(game, "shaders/vertex.glsl"), GetDataFilePath(game, "shaders/ghosttree.glsl"));
-	data->dis_shader = CreateShader(game, GetDataFilePath(game, "shaders/vertex.glsl"), GetDataFilePath(game, "shaders/dis.glsl"));
-	data->music = al_load_audio_stream(GetDataFilePath(game, "music.flac"), 4, 2048);
-
 	game->data = data;
+	InitMemoryTracking(game);
+	LoadQualitySettings(game, data);
+	LoadInputBindings(game, &data->input);
+	LoadDynamicResolutionSettings(game, data);
+	InitFramePacing(game);
+	if (IsCapturing()) {
+		// captures have to match the golden images pixel for pixel, whatever the machine's speed
+		data->dynres.enabled = false;
+		data->dynres.scale = data->dynres.max;
+	}
+	data->frame.reuse = strtol(GetConfigOptionDefault(game, "Bob", "reuse_static_frames", "1"), NULL, 10);
+	InitPreloads(game);
+	data->frame.hash = FNV_OFFSET;
+	data->font = LoadDataFont(game, "fonts/Roboto-Condensed.ttf", 58, 0);
+	LoadPostprocessingSettings(game, data);
+	CreateRenderTargets(game, data, al_get_display_width(game->display), al_get_display_height(game->display));
+	data->music = TrackAudioStream(game, LoadDataStream(game, "music.flac", 4, 2048));
 
 	data->mixer = al_create_mixer(al_get_mixer_frequency(game->audio.music), ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_2);
 	al_attach_mixer_to_mixer(data->mixer, game->audio.music);
+	SetupMusicDsp(&data->dsp.chain, &data->hum, &data->dsp.duck, al_get_mixer_frequency(data->mixer));
 	al_set_mixer_postprocess_callback(data->mixer, MixerPostprocess, game);
+	if (al_get_mixer_depth(game->audio.mixer) == ALLEGRO_AUDIO_DEPTH_FLOAT32 && al_get_mixer_channels(game->audio.mixer) == ALLEGRO_CHANNEL_CONF_2) {
+		// the limiter sits on the engine's master mixer, where voices and music finally meet
+		SetupMasterDsp(&data->dsp.master, &data->dsp.limiter, al_get_mixer_frequency(game->audio.mixer));
+		al_set_mixer_postprocess_callback(game->audio.mixer, MasterPostprocess, game);
+	} else {
+		PrintConsole(game, "DSP: master mixer isn't stereo float, leaving it unlimited");
+	}
 
 	al_set_audio_stream_playing(data->music, false);
 	al_set_audio_stream_playmode(data->music, ALLEGRO_PLAYMODE_LOOP);
 	al_attach_audio_stream_to_mixer(data->music, data->mixer);
 
-	al_set_target_bitmap(data->buffer);
-	al_clear_to_color(al_map_rgba(0, 0, 0, 0));
-	al_set_target_backbuffer(game->display);
-
 	data->tint = al_map_rgba_f(0.75, 0.85, 0.85, 0.85);
+	UpdateAudio(game, 0);
 
-	data->displacement = al_load_bitmap(GetDataFilePath(game, "displacement.png"));
+	data->displacement = TrackBitmap(game, MEMORY_BITMAPS, LoadDataBitmap(game, "displacement.png"));
 	return data;
 }
 
 void DestroyGameData(struct Game* game) {
-	al_destroy_bitmap(game->data->blur1);
-	al_destroy_bitmap(game->data->blur2);
-	al_destroy_bitmap(game->data->buffer);
-	al_destroy_bitmap(game->data->target);
-	al_destroy_bitmap(game->data->tmp);
-	al_destroy_bitmap(game->data->displacement);
+	FinishCapture(game);
+	char latency[128];
+	if (DescribeLatency(game, latency, sizeof(latency))) {
+		PrintConsole(game, "Latency: %s", latency);
+	}
+	DestroyPreloads(game);
+	DestroyFramePacing(game);
+	DestroyRenderTargets(game, game->data);
+	DestroyRenderTargetPool(game);
+	DestroyCpuWorkers(game->data->cpufx.workers);
+	DestroyCpuImage(game, &game->data->cpufx.displacement);
+	free(game->data->cpufx.columns);
+	DestroyTrackedBitmap(game, MEMORY_BITMAPS, game->data->displacement);
+	DestroyTrackedBitmap(game, MEMORY_BITMAPS, game->data->warp.lut);
+	ClearTextCache(game, NULL);
 	al_destroy_font(game->data->font);
-	al_destroy_audio_stream(game->data->music);
+	al_set_mixer_postprocess_callback(game->audio.mixer, NULL, NULL);
+	DestroyTrackedAudioStream(game, game->data->music);
 	al_destroy_mixer(game->data->mixer);
-	DestroyShader(game, game->data->kawese_shader);
-	DestroyShader(game, game->data->ghost_shader);
-	DestroyShader(game, game->data->dis_shader);
+	if (game->data->blur_shader) {
+		DestroyShader(game, game->data->blur_shader);
+	}
+	if (game->data->ghost_shader) {
+		DestroyShader(game, game->data->ghost_shader);
+	}
+	if (game->data->dis_shader) {
+		DestroyShader(game, game->data->dis_shader);
+	}
+	DestroyMemoryTracking(game);
 	free(game->data);
 }
@@ -17,9 +17,39 @@
 
 #define LIBSUPERDERPY_DATA_TYPE struct CommonResources
 #include <libsuperderpy.h>
+#include <stdatomic.h>
+#include <time.h>
 #include <vrRigidBody.h>
 #include <vrWorld.h>
 
+#define BLUR_MAX_LEVELS 6
+#define TEXT_CACHE_SIZE 32
+#define TEXT_SHADOW 0x1000 // text flag for CacheText, draws it with DrawTextWithShadow
+#define RENDER_TARGET_POOL_SIZE 16
+#define RENDER_TARGET_POOL_IDLE 5.0 // seconds a released texture is kept for reuse
+#define RENDER_TARGET_POOL_SPARE (64 * 1048576) // bytes of released textures kept at most
+#define RENDER_GRAPH_MAX_RESOURCES (BLUR_MAX_LEVELS + 4)
+#define RENDER_GRAPH_MAX_PASSES (BLUR_MAX_LEVELS * 2 + 5)
+#define RENDER_PASS_MAX_INPUTS 2
+#define RENDER_GRAPH_BACKBUFFER -1
+#define RENDER_GRAPH_VIEW_MARGIN 4 // texels around a resource cleared when it takes over a bigger bitmap
+#define DSP_BLOCK 256 // frames
+#define DSP_MAX_STAGES 8
+#define PRELOAD_SLOTS 4
+#define PRELOAD_MAX_JOBS 4
+#define SCRIPT_MAX_STEPS 128
+#define SCRIPT_MAX_LABELS 16
+#define SCRIPT_QUEUE 8
+#define SCRIPT_MAX_RUNNING 4
+#define INPUT_MAX_BUTTONS 32
+#define INPUT_MAX_STICKS 4
+#define INPUT_MAX_AXES 3
+#define INPUT_BIT(action) (1u << (action))
+#define LATENCY_SAMPLES 256
+#define CAPTURE_STEP (1 / 60.0) // seconds of game time per frame while capturing
+#define STATIC_SETTLE_FRAMES 60 // frames to let the glow feedback converge before freezing the blur
+#define ENTITY_FOOTPRINT (sizeof(struct Entity) + sizeof(vrRigidBody) + sizeof(vrShape) + sizeof(vrPolygonShape) + 4 * sizeof(vrVec2))
+
 struct Entity {
 	vrRigidBody* body;
 	vrShape* shape;
@@ -29,24 +59,339 @@ struct Entity {
 	int kind;
 };
 
+struct CachedText {
+	char* text;
+	ALLEGRO_FONT* font;
+	int flags;
+	float max_width, line_height; // wrapping; max_width is 0 for a single line
+	float width; // of the widest line
+	int lines;
+	ALLEGRO_BITMAP* bitmap;
+	float anchor; // where the alignment point lies within the bitmap
+	double used;
+};
+
+struct Oscillator {
+	double phase; // in turns
+};
+
+struct ToneParams {
+	float increment; // in turns per frame
+	float gain;
+};
+
+struct ToneChannel {
+	// written by the game thread, read by the audio callback
+	atomic_uint sequence;
+	_Atomic float increment, gain;
+};
+
+struct Tone {
+	struct Oscillator osc;
+	struct ToneChannel channel;
+	struct ToneParams current; // only touched by the audio callback
+	struct ToneParams published; // only touched by the game thread
+};
+
+struct DspStage {
+	const char* name;
+	void (*process)(void* state, float* block, unsigned int frames, int channels, unsigned int rate);
+	void* state;
+	atomic_ullong ticks; // of the DSP counter spent processing, reset by DescribeDspChain
+};
+
+struct DspChain {
+	struct DspStage stages[DSP_MAX_STAGES];
+	int count;
+	unsigned int rate;
+	int channels;
+	atomic_ullong frames;
+	double described; // al_get_time() when ticks were last converted, along with the counter's value then
+	unsigned long long counter;
+};
+
+struct Ducking {
+	atomic_bool active; // set by the game thread while a voice line plays
+	float gain;
+};
+
+struct Limiter {
+	float envelope;
+};
+
+struct LoadJob {
+	void* (*load)(struct LoadJob* job); // LoadSampleJob etc., called on one of the loader threads
+	const char* file; // within the data directory
+	ALLEGRO_FILE* fp; // opened by StartLoadJobs, from the data pack when there's one
+	const char* ident;
+	int size, flags, buffers; // depending on what's loaded: font size and flags, stream fragments and their length
+	void* result;
+};
+
+enum InputAction {
+	INPUT_UP,
+	INPUT_DOWN,
+	INPUT_W,
+	INPUT_A,
+	INPUT_S,
+	INPUT_D,
+	INPUT_SKIP,
+	INPUT_RESTART,
+	INPUT_QUIT,
+	INPUT_WIN, // debug only
+	INPUT_ACTIONS,
+};
+
+struct InputBindings {
+	// action bits for every key, button and axis
+	uint16_t keys[ALLEGRO_KEY_MAX];
+	uint16_t buttons[INPUT_MAX_BUTTONS];
+	struct {
+		uint16_t below, above; // actions held while the axis is past low or high
+		float low, high;
+	} axes[INPUT_MAX_STICKS][INPUT_MAX_AXES];
+};
+
+struct InputState {
+	uint16_t keys, buttons; // actions held through them
+	float axes[INPUT_MAX_STICKS][INPUT_MAX_AXES]; // last positions, only looked at once per tick
+	bool seen[INPUT_MAX_STICKS][INPUT_MAX_AXES];
+	uint16_t axis_actions;
+	bool moved; // axes changed since the last tick
+	int events, coalesced;
+};
+
+enum MemoryCategory {
+	MEMORY_TARGETS, // render targets, including their copies for the CPU effects
+	MEMORY_BITMAPS,
+	MEMORY_AUDIO, // decoded samples and the queues of streams
+	MEMORY_PHYSICS,
+	MEMORY_TOTAL, // all of the above; also the number of categories
+};
+
+enum ScriptOp {
+	SCRIPT_END,
+	SCRIPT_DELAY,
+	SCRIPT_VOICE,
+	SCRIPT_WAIT,
+	SCRIPT_SET,
+};
+
+struct ScriptStep {
+	enum ScriptOp op;
+	int arg; // voice to play (-1 for the next one), value to set or wait for
+	double time; // of a delay
+	bool* flag; // to wait for or set
+	const char* name; // of the flag
+};
+
+struct ScriptFlag {
+	const char* name;
+	bool* flag;
+};
+
+struct Script {
+	struct ScriptStep steps[SCRIPT_MAX_STEPS]; // every label's steps end with SCRIPT_END
+	int count;
+	struct {
+		char name[32];
+		int start;
+	} labels[SCRIPT_MAX_LABELS];
+	int label_count;
+
+	// progress through it
+	int pc; // -1 when idle
+	double timer;
+	int queue[SCRIPT_QUEUE]; // labels to run once the current one ends
+	int queued;
+	const bool* parked; // flag it waits for; nothing gets checked until it's signalled
+	bool until;
+
+	void (*voice)(struct Game* game, void* data, int voice);
+	void* data;
+};
+
+struct Preload {
+	const char* gamestate; // NULL when the slot's free
+	struct LoadJob jobs[PRELOAD_MAX_JOBS];
+	int count;
+	struct Loader* loader; // NULL once finished
+	size_t bytes; // measured when finished
+	double requested;
+};
+
+struct CpuImage {
+	float* pixels; // premultiplied RGBA, top row first
+	int width, height;
+};
+
+struct CpuWorkers;
+
+struct RenderPass {
+	const char* name;
+	int inputs[RENDER_PASS_MAX_INPUTS];
+	int input_count;
+	int output; // resource index or RENDER_GRAPH_BACKBUFFER
+	ALLEGRO_SHADER** shader; // NULL while it's still being built
+	int arg; // passed through to the draw function
+	bool reuse; // keep the output from the previous frame, as long as nothing overwrote it since
+	bool reusable; // reuse may get set, so the output has to survive until the next frame
+	void (*draw)(struct Game* game, struct RenderPass* pass, ALLEGRO_BITMAP* inputs[], ALLEGRO_BITMAP* output);
+	void (*cpu)(struct Game* game, struct RenderPass* pass, struct CpuImage* inputs[], struct CpuImage* output); // optional
+};
+
+struct RenderResource {
+	const char* name;
+	int width, height;
+	int first, last; // passes between which the resource is alive within a frame
+	int final; // last pass writing it
+	bool persistent; // read before it's written or kept for a reused pass, so it has to survive until the next frame
+	int physical;
+	ALLEGRO_BITMAP* view; // the part of the physical bitmap it uses, which may be bigger than itself
+	bool written; // during this frame
+};
+
+struct RenderGraph {
+	struct RenderResource resources[RENDER_GRAPH_MAX_RESOURCES];
+	int resource_count;
+	struct RenderPass passes[RENDER_GRAPH_MAX_PASSES];
+	int pass_count;
+	struct {
+		ALLEGRO_BITMAP* bitmap;
+		int owner; // resource whose contents the bitmap currently holds
+		int last;
+		bool persistent;
+		struct CpuImage image; // copy used by passes running on the CPU
+		bool cpu_valid, gpu_valid; // which of the copies holds the latest contents
+	} physical[RENDER_GRAPH_MAX_RESOURCES];
+	int physical_count;
+	bool cpu; // run passes on the CPU where they can
+};
+
 struct CommonResources {
 	// Fill in with common data accessible from all gamestates.
-	ALLEGRO_BITMAP *blur1, *blur2, *buffer, *target, *tmp;
-	ALLEGRO_SHADER *kawese_shader, *ghost_shader, *dis_shader;
+	struct RenderGraph graph;
+	struct {
+		int scene, blur, blur_count; // passes that can be skipped on static frames
+		int ghost;
+	} passes;
+	int blur_levels;
+	float blur_divider;
+	int width, height; // display size the render targets were created for
+
+	struct {
+		ALLEGRO_BITMAP* bitmap; // sized to a size class; targets are sub-bitmaps of it
+		bool used;
+		double released;
+	} pool[RENDER_TARGET_POOL_SIZE];
+
+	struct {
+		bool pending;
+		double time;
+	} resize;
+
+	struct {
+		bool enabled, focused, halted; // halted while the system asks the display not to draw
+		int idle_fps, background_fps;
+		ALLEGRO_EVENT_QUEUE* wake; // input cuts a throttled wait short
+		double activity; // last input
+		double next; // when the next throttled frame is due
+		double done; // when the last frame finished pacing
+		clock_t clock;
+		struct {
+			double interval, cpu, render; // per frame, averaged over unthrottled frames
+		} full;
+		struct {
+			double start, span, cpu; // wall and CPU time spent throttled
+			int frames;
+		} minute;
+		int rate; // the one last in effect, 0 meaning unthrottled
+	} pacing;
+
+	struct {
+		bool automatic, tried, probing;
+		double gpu, started; // frame time with shaders, when the CPU probe started
+		struct CpuWorkers* workers;
+		struct CpuImage displacement;
+		float* columns; // scratch for the ghost pass, grown when the targets do
+		int column_count;
+	} cpufx;
+	ALLEGRO_SHADER *blur_shader, *ghost_shader, *dis_shader;
+	struct {
+		int built, frames;
+	} warmup;
+
+	struct {
+		bool enabled;
+		ALLEGRO_BITMAP* lut;
+		double time; // the lookup texture was filled for
+	} warp;
 	ALLEGRO_BITMAP* displacement;
 	ALLEGRO_FONT* font;
+	struct CachedText text_cache[TEXT_CACHE_SIZE];
 	ALLEGRO_COLOR tint;
 	ALLEGRO_AUDIO_STREAM* music;
 	ALLEGRO_MIXER* mixer;
+	struct Tone hum;
+	struct {
+		struct DspChain chain;
+		struct DspChain master;
+		struct Ducking duck;
+		struct Limiter limiter;
+		double reported;
+	} dsp;
+	struct InputBindings input;
+	struct {
+		double pending; // timestamp of the input event whose effect the current frame shows
+		float samples[LATENCY_SAMPLES]; // seconds, the most recent ones
+		int count, reported;
+	} latency;
+	ALLEGRO_AUDIO_STREAM* narration; // voice line played last
+	bool speaking; // while the narration plays; set through SetNarration, cleared by UpdateAudio when it ends
+	struct {
+		struct Script* running[SCRIPT_MAX_RUNNING];
+		int count, parked;
+	} scripts;
+	struct {
+		struct Preload slots[PRELOAD_SLOTS];
+		ALLEGRO_MUTEX* mutex; // gamestates get loaded on the engine's loading thread
+		size_t budget, held;
+		int hits, misses;
+	} preload;
+	struct {
+		ALLEGRO_MUTEX* mutex; // resources get made on the loading threads too
+		size_t current[MEMORY_TOTAL + 1], peak[MEMORY_TOTAL + 1], budget[MEMORY_TOTAL + 1];
+		bool over[MEMORY_TOTAL + 1];
+		size_t crossed[MEMORY_TOTAL + 1]; // usage when it went over, reported from the main thread
+	} memory;
 	bool in;
 	float val, chime;
 
+	struct {
+		bool reuse;
+		uint32_t hash, last;
+		int reports, static_frames;
+	} frame;
+
+	struct {
+		bool enabled;
+		float scale, min, max;
+		double budget, average, last;
+		int over;
+		double stable, cooldown, probe;
+	} dynres;
+
 	struct {
 		bool enabled;
 		bool wasd, updown;
 		bool w, a, s, d;
 		bool up, down;
 	} hud;
+	struct {
+		// drawn over the scene every frame and kept out of its signature, for what animates on its own
+		void (*draw)(struct Game* game, void* data);
+		void* data;
+	} overlay;
 };
 
 bool IsInside(vrPolygonShape* shape, vrVec2 v);
@@ -55,6 +400,127 @@ vrVec2 GetPivot(struct Entity* entity);
 void ChangeEntitySize(struct Game* game, struct Entity* entity, float scale);
 struct Entity* CreateEntity(struct Game* game, vrWorld* world, float x, float y, float w, float h, float mass, float friction, float restitution, bool gravity, int kind);
 void DrawEntity(struct Game* game, struct Entity* entity);
+int AddRenderResource(struct RenderGraph* graph, const char* name, int width, int height);
+int AddRenderPass(struct RenderGraph* graph, struct RenderPass pass);
+void CompileRenderGraph(struct Game* game, struct RenderGraph* graph);
+void ExecuteRenderGraph(struct Game* game, struct RenderGraph* graph);
+void DestroyRenderGraph(struct Game* game, struct RenderGraph* graph);
+void TrimRenderTargetPool(struct Game* game);
+void DestroyRenderTargetPool(struct Game* game);
+void GetTextureSize(ALLEGRO_BITMAP* bitmap, float size[2]);
+void GetTextureRegion(ALLEGRO_BITMAP* bitmap, float region[4]);
+struct CpuWorkers* CreateCpuWorkers(struct Game* game);
+void DestroyCpuWorkers(struct CpuWorkers* workers);
+void ResizeCpuImage(struct Game* game, struct CpuImage* image, int width, int height);
+void DestroyCpuImage(struct Game* game, struct CpuImage* image);
+void CpuImageFromBitmap(struct Game* game, struct CpuImage* image, ALLEGRO_BITMAP* bitmap);
+void CpuImageToBitmap(struct Game* game, struct CpuImage* image, ALLEGRO_BITMAP* bitmap);
+void CpuFeedback(struct Game* game, struct RenderPass* pass, struct CpuImage* inputs[], struct CpuImage* output);
+void CpuDualFilter(struct Game* game, struct RenderPass* pass, struct CpuImage* inputs[], struct CpuImage* output);
+void CpuGhost(struct Game* game, struct RenderPass* pass, struct CpuImage* inputs[], struct CpuImage* output);
+void CpuDisplaced(struct Game* game, struct RenderPass* pass, struct CpuImage* inputs[], struct CpuImage* output);
+bool ParseCaptureArgs(int* argc, char** argv);
+bool IsCapturing(void);
+double GetLogicDelta(double delta);
+void ProcessCaptureScript(struct Game* game, double delta);
+void TranslateCaptureEvent(struct Game* game, ALLEGRO_EVENT* ev);
+void CaptureFrame(struct Game* game, double start);
+void FinishCapture(struct Game* game);
+void FailCapture(struct Game* game, const char* reason);
+int GetCaptureExitCode(void);
+void RecordAudioEvent(struct Game* game, const char* format, ...);
+void RecordSound(struct Game* game, const char* name, const char* bus, const char* file);
+struct CachedText* CacheText(struct Game* game, ALLEGRO_FONT* font, const char* text, float max_width, float line_height, int flags);
+void DrawCachedText(struct Game* game, struct CachedText* text, ALLEGRO_COLOR color, float x, float y);
+void ClearTextCache(struct Game* game, ALLEGRO_FONT* font);
+void WarmupGlyphs(struct Game* game, ALLEGRO_FONT* font, const char* name, const char* const* texts);
+void RenderOscillator(struct Oscillator* osc, float* buffer, unsigned int frames, int channels, struct ToneParams from, struct ToneParams to);
+void PublishToneParams(struct ToneChannel* channel, struct ToneParams params);
+bool ReadToneParams(struct ToneChannel* channel, struct ToneParams* params);
+void RenderTone(struct Tone* tone, float* buffer, unsigned int frames, int channels);
+void UpdateAudio(struct Game* game, double delta);
+void GlobalPostLogic(struct Game* game, double delta);
+int RunAudioRender(int* argc, char** argv);
+void* LoadSampleJob(struct LoadJob* job);
+void* LoadStreamJob(struct LoadJob* job);
+void* LoadFontJob(struct LoadJob* job);
+void* LoadBitmapJob(struct LoadJob* job);
+bool IsLoadFinished(struct Loader* loader);
+struct Loader* StartLoadJobs(struct Game* game, struct LoadJob* jobs, int count);
+void FinishLoadJobs(struct Game* game, struct Loader* loader, void (*progress)(struct Game*));
+struct AudioPrefetch* CreateAudioPrefetch(struct Game* game);
+void PrefetchAudioStream(struct Game* game, struct AudioPrefetch* prefetch, const char* path);
+ALLEGRO_AUDIO_STREAM* TakeAudioStream(struct Game* game, struct AudioPrefetch* prefetch, const char* path);
+void AdoptAudioStream(struct AudioPrefetch* prefetch, const char* path, ALLEGRO_AUDIO_STREAM* stream);
+void DestroyAudioPrefetch(struct Game* game, struct AudioPrefetch* prefetch);
+void InitDspChain(struct DspChain* chain, unsigned int rate, int channels);
+void AddDspStage(struct DspChain* chain, const char* name, void (*process)(void*, float*, unsigned int, int, unsigned int), void* state);
+void ProcessDspChain(struct DspChain* chain, float* buffer, unsigned int frames);
+bool DescribeDspChain(struct DspChain* chain, char* text, size_t size);
+void DuckStage(void* state, float* block, unsigned int frames, int channels, unsigned int rate);
+void ToneStage(void* state, float* block, unsigned int frames, int channels, unsigned int rate);
+void LimiterStage(void* state, float* block, unsigned int frames, int channels, unsigned int rate);
+void SetupMusicDsp(struct DspChain* chain, struct Tone* tone, struct Ducking* duck, unsigned int rate);
+void SetupMasterDsp(struct DspChain* chain, struct Limiter* limiter, unsigned int rate);
+int RunOscillatorBenchmark(int* argc, char** argv);
+float GetSampleValue(ALLEGRO_SAMPLE* sample, unsigned int frame, int channel);
+double GetAudioStreamPlayedSecs(ALLEGRO_AUDIO_STREAM* stream);
+void OpenDataPack(struct Game* game);
+void CloseDataPack(void);
+ALLEGRO_FILE* OpenDataFile(struct Game* game, const char* name, const char** ident);
+const char* GetDataPackPath(void);
+void GetDataFileSource(struct Game* game, const char* name, char* source, size_t size);
+bool OpenDataPackAt(const char* path);
+ALLEGRO_SAMPLE* LoadSourceSample(const char* source);
+ALLEGRO_BITMAP* LoadDataBitmap(struct Game* game, const char* name);
+ALLEGRO_FONT* LoadDataFont(struct Game* game, const char* name, int size, int flags);
+ALLEGRO_AUDIO_STREAM* LoadDataStream(struct Game* game, const char* name, size_t buffers, unsigned int samples);
+void ReportDataLoading(struct Game* game, const char* milestone);
+int RunDataPack(int* argc, char** argv);
+bool CompileScript(struct Game* game, struct Script* script, const char* file, const struct ScriptFlag* flags, int count);
+int FindScriptLabel(struct Script* script, const char* name);
+void QueueScript(struct Script* script, int label);
+void ResetScript(struct Game* game, struct Script* script);
+void RunScript(struct Game* game, struct Script* script, double delta);
+void RegisterScript(struct Game* game, struct Script* script);
+void UnregisterScript(struct Game* game, struct Script* script);
+void SignalScripts(struct Game* game, const bool* flag);
+void SetNarration(struct Game* game, ALLEGRO_AUDIO_STREAM* stream);
+void LoadInputBindings(struct Game* game, struct InputBindings* bindings);
+uint16_t ProcessInputEvent(struct Game* game, struct InputState* input, ALLEGRO_EVENT* ev);
+uint16_t UpdateInput(struct Game* game, struct InputState* input);
+void MarkInputShown(struct Game* game, double timestamp);
+void FinishLatencyFrame(struct Game* game);
+bool DescribeLatency(struct Game* game, char* text, size_t size);
+void InitMemoryTracking(struct Game* game);
+void TrackMemory(struct Game* game, enum MemoryCategory category, size_t bytes);
+void ReleaseMemory(struct Game* game, enum MemoryCategory category, size_t bytes);
+size_t GetMemoryUsage(struct Game* game, enum MemoryCategory category, size_t* peak);
+bool DescribeMemory(struct Game* game, char* text, size_t size);
+void ReportMemoryBudgets(struct Game* game);
+void DestroyMemoryTracking(struct Game* game);
+size_t MeasureBitmap(ALLEGRO_BITMAP* bitmap);
+size_t MeasureSample(ALLEGRO_SAMPLE* sample);
+size_t MeasureAudioStream(ALLEGRO_AUDIO_STREAM* stream);
+ALLEGRO_BITMAP* TrackBitmap(struct Game* game, enum MemoryCategory category, ALLEGRO_BITMAP* bitmap);
+void DestroyTrackedBitmap(struct Game* game, enum MemoryCategory category, ALLEGRO_BITMAP* bitmap);
+ALLEGRO_SAMPLE* TrackSample(struct Game* game, ALLEGRO_SAMPLE* sample);
+void DestroyTrackedSample(struct Game* game, ALLEGRO_SAMPLE* sample);
+ALLEGRO_AUDIO_STREAM* TrackAudioStream(struct Game* game, ALLEGRO_AUDIO_STREAM* stream);
+void DestroyTrackedAudioStream(struct Game* game, ALLEGRO_AUDIO_STREAM* stream);
+void TrackLoadJob(struct Game* game, struct LoadJob* job);
+void DestroyLoadJobResult(struct Game* game, struct LoadJob* job);
+void InitFramePacing(struct Game* game);
+void NoteFramePacingEvent(struct Game* game, ALLEGRO_EVENT* ev);
+void PaceFrame(struct Game* game, double start);
+void DestroyFramePacing(struct Game* game);
+void InitPreloads(struct Game* game);
+void PreloadGamestate(struct Game* game, const char* name);
+void LoadGamestateResources(struct Game* game, const char* name, void** results, void (*progress)(struct Game*));
+void UpdatePreloads(struct Game* game);
+void DestroyPreloads(struct Game* game);
+void AddFrameSignature(struct Game* game, const void* state, size_t size);
+void SubmitFrameSignature(struct Game* game);
 struct CommonResources* CreateGameData(struct Game* game);
 void DestroyGameData(struct Game* game);
 bool GlobalEventHandler(struct Game* game, ALLEGRO_EVENT* ev);
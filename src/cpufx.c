@@ -0,0 +1,454 @@
+/*! \file cpufx.c
+ *  \brief CPU implementation of the post-processing passes, for when shaders aren't there or are too slow.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <libsuperderpy.h>
+
+#define CPUFX_MAX_THREADS 8
+#define CPUFX_MIN_ROWS 32 // images smaller than that aren't worth splitting between threads
+#define CPUFX_CHUNKS_PER_THREAD 4
+
+// Every pixel is a vector of four floats, so one SIMD register holds a whole RGBA value.
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CPUFX_SIMD "SSE2"
+
+typedef __m128 v4;
+
+static inline v4 v4_load(const float* p) { return _mm_loadu_ps(p); }
+static inline void v4_store(float* p, v4 v) { _mm_storeu_ps(p, v); }
+static inline v4 v4_splat(float f) { return _mm_set1_ps(f); }
+static inline v4 v4_set(float r, float g, float b, float a) { return _mm_setr_ps(r, g, b, a); }
+static inline v4 v4_add(v4 a, v4 b) { return _mm_add_ps(a, b); }
+static inline v4 v4_sub(v4 a, v4 b) { return _mm_sub_ps(a, b); }
+static inline v4 v4_mul(v4 a, v4 b) { return _mm_mul_ps(a, b); }
+static inline v4 v4_clamp(v4 v) { return _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f)); }
+static inline float v4_alpha(v4 v) { return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))); }
+
+static inline v4 v4_from_rgba8(const unsigned char* p) {
+	int word;
+	memcpy(&word, p, sizeof(word));
+	__m128i zero = _mm_setzero_si128();
+	__m128i px = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(word), zero), zero);
+	return _mm_mul_ps(_mm_cvtepi32_ps(px), _mm_set1_ps(1.0f / 255.0f));
+}
+
+static inline void v4_to_rgba8(unsigned char* p, v4 v) {
+	__m128i px = _mm_cvtps_epi32(_mm_mul_ps(v4_clamp(v), _mm_set1_ps(255.0f)));
+	px = _mm_packs_epi32(px, px);
+	px = _mm_packus_epi16(px, px);
+	int word = _mm_cvtsi128_si32(px);
+	memcpy(p, &word, sizeof(word));
+}
+
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CPUFX_SIMD "NEON"
+
+typedef float32x4_t v4;
+
+static inline v4 v4_load(const float* p) { return vld1q_f32(p); }
+static inline void v4_store(float* p, v4 v) { vst1q_f32(p, v); }
+static inline v4 v4_splat(float f) { return vdupq_n_f32(f); }
+static inline v4 v4_set(float r, float g, float b, float a) {
+	float values[4] = {r, g, b, a};
+	return vld1q_f32(values);
+}
+static inline v4 v4_add(v4 a, v4 b) { return vaddq_f32(a, b); }
+static inline v4 v4_sub(v4 a, v4 b) { return vsubq_f32(a, b); }
+static inline v4 v4_mul(v4 a, v4 b) { return vmulq_f32(a, b); }
+static inline v4 v4_clamp(v4 v) { return vminq_f32(vmaxq_f32(v, vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f)); }
+static inline float v4_alpha(v4 v) { return vgetq_lane_f32(v, 3); }
+
+static inline v4 v4_from_rgba8(const unsigned char* p) {
+	uint32_t word;
+	memcpy(&word, p, sizeof(word));
+	uint16x8_t px = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(word)));
+	return vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(px))), 1.0f / 255.0f);
+}
+
+static inline void v4_to_rgba8(unsigned char* p, v4 v) {
+	uint16x4_t px = vmovn_u32(vcvtq_u32_f32(vaddq_f32(vmulq_n_f32(v4_clamp(v), 255.0f), vdupq_n_f32(0.5f))));
+	uint32_t word = vget_lane_u32(vreinterpret_u32_u8(vmovn_u16(vcombine_u16(px, px))), 0);
+	memcpy(p, &word, sizeof(word));
+}
+
+#else
+#define CPUFX_SIMD "scalar"
+
+typedef struct {
+	float c[4];
+} v4;
+
+static inline v4 v4_load(const float* p) { return (v4){{p[0], p[1], p[2], p[3]}}; }
+static inline void v4_store(float* p, v4 v) { memcpy(p, v.c, sizeof(v.c)); }
+static inline v4 v4_splat(float f) { return (v4){{f, f, f, f}}; }
+static inline v4 v4_set(float r, float g, float b, float a) { return (v4){{r, g, b, a}}; }
+static inline v4 v4_add(v4 a, v4 b) { return (v4){{a.c[0] + b.c[0], a.c[1] + b.c[1], a.c[2] + b.c[2], a.c[3] + b.c[3]}}; }
+static inline v4 v4_sub(v4 a, v4 b) { return (v4){{a.c[0] - b.c[0], a.c[1] - b.c[1], a.c[2] - b.c[2], a.c[3] - b.c[3]}}; }
+static inline v4 v4_mul(v4 a, v4 b) { return (v4){{a.c[0] * b.c[0], a.c[1] * b.c[1], a.c[2] * b.c[2], a.c[3] * b.c[3]}}; }
+static inline v4 v4_clamp(v4 v) { return (v4){{fminf(1, fmaxf(0, v.c[0])), fminf(1, fmaxf(0, v.c[1])), fminf(1, fmaxf(0, v.c[2])), fminf(1, fmaxf(0, v.c[3]))}}; }
+static inline float v4_alpha(v4 v) { return v.c[3]; }
+
+static inline v4 v4_from_rgba8(const unsigned char* p) { return (v4){{p[0] / 255.0f, p[1] / 255.0f, p[2] / 255.0f, p[3] / 255.0f}}; }
+
+static inline void v4_to_rgba8(unsigned char* p, v4 v) {
+	v = v4_clamp(v);
+	for (int i = 0; i < 4; i++) {
+		p[i] = v.c[i] * 255.0f + 0.5f;
+	}
+}
+#endif
+
+static inline v4 v4_lerp(v4 a, v4 b, float f) {
+	return v4_add(a, v4_mul(v4_sub(b, a), v4_splat(f)));
+}
+
+static inline v4 Over(v4 src, v4 dst) {
+	// premultiplied alpha blending, like Allegro's default blender into an 8-bit target
+	return v4_clamp(v4_add(src, v4_mul(dst, v4_splat(1.0f - v4_alpha(src)))));
+}
+
+static inline v4 Texel(const struct CpuImage* image, int x, int y, bool clamp) {
+	if (clamp) {
+		x = x < 0 ? 0 : (x >= image->width ? image->width - 1 : x);
+		y = y < 0 ? 0 : (y >= image->height ? image->height - 1 : y);
+	} else if (x < 0 || y < 0 || x >= image->width || y >= image->height) {
+		// pooled textures are transparent around the sub-bitmaps, so that's what the GPU reads there
+		return v4_splat(0.0f);
+	}
+	return v4_load(&image->pixels[(y * image->width + x) * 4]);
+}
+
+static inline v4 Sample(const struct CpuImage* image, float x, float y, bool clamp) {
+	// bilinear filtering, with x and y in pixels
+	x -= 0.5f;
+	y -= 0.5f;
+	float fx = floorf(x), fy = floorf(y);
+	int x0 = fx, y0 = fy;
+	v4 top = v4_lerp(Texel(image, x0, y0, clamp), Texel(image, x0 + 1, y0, clamp), x - fx);
+	v4 bottom = v4_lerp(Texel(image, x0, y0 + 1, clamp), Texel(image, x0 + 1, y0 + 1, clamp), x - fx);
+	return v4_lerp(top, bottom, y - fy);
+}
+
+struct CpuJob {
+	void (*rows)(struct CpuJob* job, int from, int to);
+	int height;
+	struct CpuImage** inputs;
+	struct CpuImage* output;
+	struct CpuImage* displacement;
+	ALLEGRO_LOCKED_REGION* region;
+	v4 color;
+	float offset, time;
+	bool up;
+	float* columns;
+};
+
+struct CpuWorkers {
+	ALLEGRO_THREAD* threads[CPUFX_MAX_THREADS];
+	int count;
+	ALLEGRO_MUTEX* mutex;
+	ALLEGRO_COND *start, *done;
+	struct CpuJob* job;
+	int generation, chunks, next, finished;
+	bool quit;
+};
+
+static void RunChunks(struct CpuWorkers* workers) {
+	// called with the mutex locked
+	while (workers->next < workers->chunks) {
+		struct CpuJob* job = workers->job;
+		int chunk = workers->next++;
+		al_unlock_mutex(workers->mutex);
+		job->rows(job, job->height * chunk / workers->chunks, job->height * (chunk + 1) / workers->chunks);
+		al_lock_mutex(workers->mutex);
+		workers->finished++;
+	}
+}
+
+static void* WorkerThread(ALLEGRO_THREAD* thread, void* arg) {
+	struct CpuWorkers* workers = arg;
+	int generation = 0;
+
+	al_lock_mutex(workers->mutex);
+	while (!workers->quit) {
+		if (workers->generation == generation) {
+			al_wait_cond(workers->start, workers->mutex);
+			continue;
+		}
+		generation = workers->generation;
+		RunChunks(workers);
+		if (workers->finished == workers->chunks) {
+			al_broadcast_cond(workers->done);
+		}
+	}
+	al_unlock_mutex(workers->mutex);
+	return NULL;
+}
+
+static void ForEachRow(struct CpuWorkers* workers, struct CpuJob* job) {
+	if (!workers || !workers->count || job->height < CPUFX_MIN_ROWS) {
+		job->rows(job, 0, job->height);
+		return;
+	}
+
+	al_lock_mutex(workers->mutex);
+	workers->job = job;
+	workers->next = 0;
+	workers->finished = 0;
+	workers->chunks = fmin((workers->count + 1) * CPUFX_CHUNKS_PER_THREAD, job->height / (CPUFX_MIN_ROWS / 2));
+	workers->generation++;
+	al_broadcast_cond(workers->start);
+	RunChunks(workers);
+	while (workers->finished < workers->chunks) {
+		al_wait_cond(workers->done, workers->mutex);
+	}
+	al_unlock_mutex(workers->mutex);
+}
+
+struct CpuWorkers* CreateCpuWorkers(struct Game* game) {
+	struct CpuWorkers* workers = calloc(1, sizeof(struct CpuWorkers));
+	workers->mutex = al_create_mutex();
+	workers->start = al_create_cond();
+	workers->done = al_create_cond();
+	// the main thread takes its share of the rows too
+	workers->count = fmax(0, fmin(CPUFX_MAX_THREADS, al_get_cpu_count() - 1));
+	for (int i = 0; i < workers->count; i++) {
+		workers->threads[i] = al_create_thread(WorkerThread, workers);
+		al_start_thread(workers->threads[i]);
+	}
+	PrintConsole(game, "CPU post-processing: %s, %d worker threads", CPUFX_SIMD, workers->count);
+	return workers;
+}
+
+void DestroyCpuWorkers(struct CpuWorkers* workers) {
+	if (!workers) {
+		return;
+	}
+	al_lock_mutex(workers->mutex);
+	workers->quit = true;
+	al_broadcast_cond(workers->start);
+	al_unlock_mutex(workers->mutex);
+	for (int i = 0; i < workers->count; i++) {
+		al_join_thread(workers->threads[i], NULL);
+		al_destroy_thread(workers->threads[i]);
+	}
+	al_destroy_cond(workers->start);
+	al_destroy_cond(workers->done);
+	al_destroy_mutex(workers->mutex);
+	free(workers);
+}
+
+void ResizeCpuImage(struct Game* game, struct CpuImage* image, int width, int height) {
+	if (image->pixels && image->width == width && image->height == height) {
+		return;
+	}
+	DestroyCpuImage(game, image);
+	image->pixels = calloc((size_t)width * height * 4, sizeof(float));
+	image->width = width;
+	image->height = height;
+	TrackMemory(game, MEMORY_TARGETS, (size_t)width * height * 4 * sizeof(float));
+}
+
+void DestroyCpuImage(struct Game* game, struct CpuImage* image) {
+	if (image->pixels) {
+		ReleaseMemory(game, MEMORY_TARGETS, (size_t)image->width * image->height * 4 * sizeof(float));
+	}
+	free(image->pixels);
+	*image = (struct CpuImage){0};
+}
+
+static void DownloadRows(struct CpuJob* job, int from, int to) {
+	for (int y = from; y < to; y++) {
+		const unsigned char* in = (const unsigned char*)job->region->data + y * job->region->pitch;
+		float* out = &job->output->pixels[y * job->output->width * 4];
+		for (int x = 0; x < job->output->width; x++) {
+			v4_store(out + x * 4, v4_from_rgba8(in + x * 4));
+		}
+	}
+}
+
+static void UploadRows(struct CpuJob* job, int from, int to) {
+	for (int y = from; y < to; y++) {
+		const float* in = &job->inputs[0]->pixels[y * job->inputs[0]->width * 4];
+		unsigned char* out = (unsigned char*)job->region->data + y * job->region->pitch;
+		for (int x = 0; x < job->inputs[0]->width; x++) {
+			v4_to_rgba8(out + x * 4, v4_load(in + x * 4));
+		}
+	}
+}
+
+void CpuImageFromBitmap(struct Game* game, struct CpuImage* image, ALLEGRO_BITMAP* bitmap) {
+	ResizeCpuImage(game, image, al_get_bitmap_width(bitmap), al_get_bitmap_height(bitmap));
+	ALLEGRO_LOCKED_REGION* region = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY);
+	if (!region) {
+		PrintConsole(game, "CPU post-processing: couldn't lock a %dx%d bitmap for reading", image->width, image->height);
+		return;
+	}
+	struct CpuJob job = {.rows = DownloadRows, .height = image->height, .output = image, .region = region};
+	ForEachRow(game->data->cpufx.workers, &job);
+	al_unlock_bitmap(bitmap);
+}
+
+void CpuImageToBitmap(struct Game* game, struct CpuImage* image, ALLEGRO_BITMAP* bitmap) {
+	ALLEGRO_LOCKED_REGION* region = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_WRITEONLY);
+	if (!region) {
+		PrintConsole(game, "CPU post-processing: couldn't lock a %dx%d bitmap for writing", image->width, image->height);
+		return;
+	}
+	struct CpuJob job = {.rows = UploadRows, .height = image->height, .inputs = &image, .region = region};
+	ForEachRow(game->data->cpufx.workers, &job);
+	al_unlock_bitmap(bitmap);
+}
+
+static struct CpuImage* GetDisplacement(struct Game* game) {
+	if (!game->data->cpufx.displacement.pixels) {
+		CpuImageFromBitmap(game, &game->data->cpufx.displacement, game->data->displacement);
+	}
+	return &game->data->cpufx.displacement;
+}
+
+static void FeedbackRows(struct CpuJob* job, int from, int to) {
+	// tinted copy of the previous frame, shifted up by a fraction of a pixel
+	struct CpuImage *src = job->inputs[0], *dst = job->output;
+	for (int y = from; y < to; y++) {
+		float sy = y + job->offset;
+		int y0 = floorf(sy);
+		float f = sy - y0;
+		float* out = &dst->pixels[y * dst->width * 4];
+		for (int x = 0; x < dst->width; x++) {
+			v4 color = v4_lerp(Texel(src, x, y0, false), Texel(src, x, y0 + 1, false), f);
+			v4_store(out + x * 4, v4_clamp(v4_mul(color, job->color)));
+		}
+	}
+}
+
+void CpuFeedback(struct Game* game, struct RenderPass* pass, struct CpuImage* inputs[], struct CpuImage* output) {
+	ALLEGRO_COLOR tint = game->data->tint;
+	float scale = output->height / (float)al_get_display_height(game->display);
+	struct CpuJob job = {.rows = FeedbackRows, .height = output->height, .inputs = inputs, .output = output,
+		.color = v4_set(tint.r, tint.g, tint.b, tint.a), .offset = game->clip_rect.h * 0.003 * scale};
+	ForEachRow(game->data->cpufx.workers, &job);
+}
+
+static void DualFilterRows(struct CpuJob* job, int from, int to) {
+	// same taps as dualfilter.glsl, in source pixels
+	struct CpuImage *src = job->inputs[0], *dst = job->output;
+	float sx = src->width / (float)dst->width, sy = src->height / (float)dst->height;
+	for (int y = from; y < to; y++) {
+		float cy = (y + 0.5f) * sy;
+		float* out = &dst->pixels[y * dst->width * 4];
+		for (int x = 0; x < dst->width; x++) {
+			float cx = (x + 0.5f) * sx;
+			v4 sum;
+			if (job->up) {
+				sum = Sample(src, cx - 1.0f, cy, false);
+				sum = v4_add(sum, Sample(src, cx + 1.0f, cy, false));
+				sum = v4_add(sum, Sample(src, cx, cy - 1.0f, false));
+				sum = v4_add(sum, Sample(src, cx, cy + 1.0f, false));
+				v4 diagonal = Sample(src, cx - 0.5f, cy - 0.5f, false);
+				diagonal = v4_add(diagonal, Sample(src, cx + 0.5f, cy - 0.5f, false));
+				diagonal = v4_add(diagonal, Sample(src, cx - 0.5f, cy + 0.5f, false));
+				diagonal = v4_add(diagonal, Sample(src, cx + 0.5f, cy + 0.5f, false));
+				sum = v4_mul(v4_add(sum, v4_add(diagonal, diagonal)), v4_splat(1.0f / 12.0f));
+			} else {
+				sum = v4_mul(Sample(src, cx, cy, false), v4_splat(4.0f));
+				sum = v4_add(sum, Sample(src, cx - 0.5f, cy - 0.5f, false));
+				sum = v4_add(sum, Sample(src, cx + 0.5f, cy - 0.5f, false));
+				sum = v4_add(sum, Sample(src, cx - 0.5f, cy + 0.5f, false));
+				sum = v4_add(sum, Sample(src, cx + 0.5f, cy + 0.5f, false));
+				sum = v4_mul(sum, v4_splat(1.0f / 8.0f));
+			}
+			v4_store(out + x * 4, v4_clamp(sum));
+		}
+	}
+}
+
+void CpuDualFilter(struct Game* game, struct RenderPass* pass, struct CpuImage* inputs[], struct CpuImage* output) {
+	struct CpuJob job = {.rows = DualFilterRows, .height = output->height, .inputs = inputs, .output = output, .up = pass->arg};
+	ForEachRow(game->data->cpufx.workers, &job);
+}
+
+static void GhostRows(struct CpuJob* job, int from, int to) {
+	// ghosttree.glsl; the warp is split into terms depending on the row and on the column only
+	struct CpuImage *glow = job->inputs[0], *dst = job->output, *dis = job->displacement;
+	float t = job->time / 16.0;
+	for (int y = from; y < to; y++) {
+		float v = 1.0 - (y + 0.5) / dst->height; // GL texture coordinates go upwards
+		float warpx = (0.7 * sinf((v + t) * 4.0) * 0.038 + 0.3 * sinf((v + t) * 8.0) * 0.010 + 0.05 * sinf((v + t) * 40.0) * 0.05) / 8.0;
+		float warpy = 0.5 * sinf((v + t) * 5.0) * 0.1 / 8.0;
+		float* out = &dst->pixels[y * dst->width * 4];
+		for (int x = 0; x < dst->width; x++) {
+			float u = (x + 0.5) / dst->width;
+			float px = fminf(1, fmaxf(0, u + warpx));
+			float py = fminf(1, fmaxf(0, v + warpy + job->columns[x]));
+
+			float d[4];
+			v4_store(d, Sample(dis, px * dis->width, (1.0 - py) * dis->height, true));
+			px += d[0] / 256.0;
+			py += d[1] / 256.0;
+
+			v4 color = v4_mul(Sample(glow, px * glow->width, (1.0 - py) * glow->height, false), v4_splat(1.0 - d[0] * 0.2));
+			color = v4_add(color, v4_set(0.0, d[1] * 0.025, d[2] * 0.125, 0.0));
+			v4_store(out + x * 4, v4_clamp(color));
+		}
+	}
+}
+
+void CpuGhost(struct Game* game, struct RenderPass* pass, struct CpuImage* inputs[], struct CpuImage* output) {
+	float t = game->time / 16.0;
+	if (game->data->cpufx.column_count < output->width) {
+		free(game->data->cpufx.columns);
+		game->data->cpufx.columns = malloc(output->width * sizeof(float));
+		game->data->cpufx.column_count = output->width;
+	}
+	float* columns = game->data->cpufx.columns;
+	for (int x = 0; x < output->width; x++) {
+		float u = (x + 0.5) / output->width;
+		columns[x] = (0.2 * sinf((u + t) * 10.0) * 0.05 + 0.2 * sinf((u + t) * 30.0) * 0.02) / 8.0;
+	}
+	struct CpuJob job = {.rows = GhostRows, .height = output->height, .inputs = inputs, .output = output,
+		.displacement = GetDisplacement(game), .time = game->time, .columns = columns};
+	ForEachRow(game->data->cpufx.workers, &job);
+}
+
+static void DisplacedRows(struct CpuJob* job, int from, int to) {
+	// dis.glsl over the ghost, then half of the glow on top
+	struct CpuImage *target = job->inputs[0], *glow = job->inputs[1], *dst = job->output, *dis = job->displacement;
+	for (int y = from; y < to; y++) {
+		float fy = (y + 0.5f) / dst->height;
+		float* out = &dst->pixels[y * dst->width * 4];
+		for (int x = 0; x < dst->width; x++) {
+			float fx = (x + 0.5f) / dst->width;
+			float d[4];
+			v4_store(d, Sample(dis, fx * dis->width, fy * dis->height, true));
+
+			v4 color = Over(v4_clamp(v4_sub(Texel(target, x, y, false), v4_splat(d[1] * 0.3f))), v4_load(out + x * 4));
+			color = Over(v4_mul(Sample(glow, fx * glow->width, fy * glow->height, false), v4_splat(0.5f)), color);
+			v4_store(out + x * 4, color);
+		}
+	}
+}
+
+void CpuDisplaced(struct Game* game, struct RenderPass* pass, struct CpuImage* inputs[], struct CpuImage* output) {
+	struct CpuJob job = {.rows = DisplacedRows, .height = output->height, .inputs = inputs, .output = output, .displacement = GetDisplacement(game)};
+	ForEachRow(game->data->cpufx.workers, &job);
+}
@@ -0,0 +1,161 @@
+/*! \file dsp.c
+ *  \brief Chains of effects processing the game's mixers in fixed-size blocks.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <libsuperderpy.h>
+#include <stdio.h>
+#include <time.h>
+
+#define DUCK_LEVEL 0.4 // music gain under voice lines, about -8 dB
+#define DUCK_ATTACK 0.05 // seconds
+#define DUCK_RELEASE 0.4
+#define LIMITER_THRESHOLD 0.9
+#define LIMITER_RELEASE 0.1
+
+// Stages run on the audio thread: they work in place on blocks of at most DSP_BLOCK frames of the
+// mixer's own buffer and must not allocate, lock or wait on anything. Parameters come in through atomics.
+// That buffer is allocated by the mixer up front and only ever touched by the callback, so it serves as
+// the preallocated scratch space; copying each block into one of the chain's own would add nothing.
+
+// Stage timing reads a counter at each boundary between stages, once per callback. It's the CPU's
+// timestamp counter where there is one, so the reads cost a few cycles; ticks get converted to time
+// by comparing the counter against al_get_time() whenever the chain is described.
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+static inline unsigned long long ReadDspCounter(void) {
+	return __rdtsc();
+}
+#elif defined(__aarch64__) && !defined(_MSC_VER)
+static inline unsigned long long ReadDspCounter(void) {
+	unsigned long long value;
+	__asm__ volatile("mrs %0, cntvct_el0" : "=r"(value));
+	return value;
+}
+#else
+static inline unsigned long long ReadDspCounter(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+void InitDspChain(struct DspChain* chain, unsigned int rate, int channels) {
+	*chain = (struct DspChain){.rate = rate, .channels = channels, .described = al_get_time(), .counter = ReadDspCounter()};
+}
+
+void AddDspStage(struct DspChain* chain, const char* name, void (*process)(void*, float*, unsigned int, int, unsigned int), void* state) {
+	if (chain->count == DSP_MAX_STAGES) {
+		return;
+	}
+	chain->stages[chain->count++] = (struct DspStage){.name = name, .process = process, .state = state};
+}
+
+void ProcessDspChain(struct DspChain* chain, float* buffer, unsigned int frames) {
+	unsigned long long before = ReadDspCounter();
+	for (int i = 0; i < chain->count; i++) {
+		struct DspStage* stage = &chain->stages[i];
+		for (unsigned int offset = 0; offset < frames; offset += DSP_BLOCK) {
+			unsigned int block = frames - offset < DSP_BLOCK ? frames - offset : DSP_BLOCK;
+			stage->process(stage->state, buffer + offset * chain->channels, block, chain->channels, chain->rate);
+		}
+		unsigned long long after = ReadDspCounter();
+		atomic_fetch_add_explicit(&stage->ticks, after - before, memory_order_relaxed);
+		before = after;
+	}
+	atomic_fetch_add_explicit(&chain->frames, frames, memory_order_relaxed);
+}
+
+bool DescribeDspChain(struct DspChain* chain, char* text, size_t size) {
+	// CPU time of each stage since the last call, relative to how much audio got processed meanwhile
+	double now = al_get_time();
+	unsigned long long counter = ReadDspCounter();
+	double per_second = (counter - chain->counter) / fmax(now - chain->described, 1e-9);
+	chain->described = now;
+	chain->counter = counter;
+	unsigned long long frames = atomic_exchange_explicit(&chain->frames, 0, memory_order_relaxed);
+	if (!frames || per_second <= 0) {
+		return false;
+	}
+	double total = 0;
+	text[0] = 0;
+	for (int i = 0; i < chain->count; i++) {
+		double ns = atomic_exchange_explicit(&chain->stages[i].ticks, 0, memory_order_relaxed) / per_second * 1e9;
+		total += ns;
+		size_t len = strlen(text);
+		snprintf(text + len, size - len, "%s%s %.1f ns", i ? ", " : "", chain->stages[i].name, ns / frames);
+	}
+	size_t len = strlen(text);
+	snprintf(text + len, size - len, " per frame, %.3f%% of real time", total / 1e9 / (frames / (double)chain->rate) * 100);
+	return true;
+}
+
+void SetupMusicDsp(struct DspChain* chain, struct Tone* tone, struct Ducking* duck, unsigned int rate) {
+	// what the music mixer goes through, shared with the offline renderer so both sound the same
+	InitDspChain(chain, rate, 2);
+	duck->gain = 1;
+	AddDspStage(chain, "ducking", DuckStage, duck);
+	AddDspStage(chain, "tone", ToneStage, tone);
+}
+
+void SetupMasterDsp(struct DspChain* chain, struct Limiter* limiter, unsigned int rate) {
+	// the final mix, music and voices together, so nothing that reaches the output can clip
+	InitDspChain(chain, rate, 2);
+	AddDspStage(chain, "limiter", LimiterStage, limiter);
+}
+
+void DuckStage(void* state, float* block, unsigned int frames, int channels, unsigned int rate) {
+	struct Ducking* duck = state;
+	float target = atomic_load_explicit(&duck->active, memory_order_relaxed) ? DUCK_LEVEL : 1.0;
+	float coefficient = expf(-1.0f / ((target < duck->gain ? DUCK_ATTACK : DUCK_RELEASE) * rate));
+	for (unsigned int i = 0; i < frames; i++) {
+		duck->gain = target + (duck->gain - target) * coefficient;
+		for (int c = 0; c < channels; c++) {
+			block[i * channels + c] *= duck->gain;
+		}
+	}
+}
+
+void ToneStage(void* state, float* block, unsigned int frames, int channels, unsigned int rate) {
+	RenderTone(state, block, frames, channels);
+}
+
+void LimiterStage(void* state, float* block, unsigned int frames, int channels, unsigned int rate) {
+	// peaks over the threshold get pulled down right away and let go of slowly
+	struct Limiter* limiter = state;
+	float release = expf(-1.0f / (LIMITER_RELEASE * rate));
+	for (unsigned int i = 0; i < frames; i++) {
+		float peak = 0;
+		for (int c = 0; c < channels; c++) {
+			peak = fmaxf(peak, fabsf(block[i * channels + c]));
+		}
+		limiter->envelope = fmaxf(peak, limiter->envelope * release);
+		if (limiter->envelope > LIMITER_THRESHOLD) {
+			float gain = LIMITER_THRESHOLD / limiter->envelope;
+			for (int c = 0; c < channels; c++) {
+				block[i * channels + c] *= gain;
+			}
+		}
+	}
+}
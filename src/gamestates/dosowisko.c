@@ -74,6 +74,7 @@ static TM_ACTION(End) {
 static TM_ACTION(Play) {
 	TM_RunningOnly;
 	al_play_sample_instance(TM_Arg(0));
+	RecordSound(game, TM_Arg(1), "fx", TM_Arg(2));
 	return true;
 }
 
@@ -85,13 +86,14 @@ static TM_ACTION(Type) {
 		TM_AddBackgroundAction(data->timeline, Type, NULL, (60 + rand() % 60) / 1000.0);
 	} else {
 		al_stop_sample_instance(data->kbd);
+		RecordAudioEvent(game, "sound kbd stop");
 	}
 	return true;
 }
 //==================================Timeline manager actions END
 
 void Gamestate_Logic(struct Game* game, struct GamestateResources* data, double delta) {
-	TM_Process(data->timeline, delta);
+	TM_Process(data->timeline, GetLogicDelta(delta));
 	data->underscore = Fract(game->time) >= 0.5;
 }
 
@@ -108,8 +110,8 @@ void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
 		al_set_target_bitmap(data->bitmap);
 		al_clear_to_color(al_map_rgba(0, 0, 0, 0));
 
-		al_draw_text(data->font, al_map_rgba(255, 255, 255, 10), 320 / 2.0,
-			180 * 0.4167, ALLEGRO_ALIGN_CENTRE, t);
+		DrawCachedText(game, CacheText(game, data->font, t, 0, 0, ALLEGRO_ALIGN_CENTRE), al_map_rgba(255, 255, 255, 10), 320 / 2.0,
+			180 * 0.4167);
 
 		double tg = tan(-data->tan / 384.0 * ALLEGRO_PI - ALLEGRO_PI / 2);
 
@@ -139,6 +141,8 @@ void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
 }
 
 void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
+	ReportDataLoading(game, "the logo started");
+	PreloadGamestate(game, NEXT_GAMESTATE);
 	data->pos = 1;
 	data->fade = 0;
 	data->tan = 64;
@@ -148,15 +152,16 @@ void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
 	TM_AddDelay(data->timeline, 0.3);
 	TM_AddQueuedBackgroundAction(data->timeline, FadeIn, NULL, 0);
 	TM_AddDelay(data->timeline, 1.5);
-	TM_AddNamedAction(data->timeline, Play, TM_Args(data->kbd), "PlayKbd");
+	TM_AddNamedAction(data->timeline, Play, TM_Args(data->kbd, "kbd", "kbd.flac"), "PlayKbd");
 	TM_AddQueuedBackgroundAction(data->timeline, Type, NULL, 0);
 	TM_AddDelay(data->timeline, 3.2);
-	TM_AddNamedAction(data->timeline, Play, TM_Args(data->key), "PlayKey");
+	TM_AddNamedAction(data->timeline, Play, TM_Args(data->key, "key", "key.flac"), "PlayKey");
 	TM_AddDelay(data->timeline, 0.05);
 	TM_AddAction(data->timeline, FadeOut, NULL);
 	TM_AddDelay(data->timeline, 1.0);
 	TM_AddAction(data->timeline, End, NULL);
 	al_play_sample_instance(data->sound);
+	RecordSound(game, "dosowisko", "music", "dosowisko.flac");
 }
 
 void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data, ALLEGRO_EVENT* ev) {
@@ -171,33 +176,38 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 	int flags = al_get_new_bitmap_flags();
 	al_set_new_bitmap_flags(flags & ~ALLEGRO_MAG_LINEAR);
 
+	// decoded in the background while the bitmaps get created here
+	struct LoadJob jobs[] = {
+		{.load = LoadFontJob, .file = "fonts/DejaVuSansMono.ttf", .size = (int)(180 * 0.1666 / 8) * 8},
+		{.load = LoadSampleJob, .file = "dosowisko.flac"},
+		{.load = LoadSampleJob, .file = "kbd.flac"},
+		{.load = LoadSampleJob, .file = "key.flac"},
+	};
+	struct Loader* loader = StartLoadJobs(game, jobs, sizeof(jobs) / sizeof(jobs[0]));
+
 	data->timeline = TM_Init(game, data, "main");
-	data->bitmap = CreateNotPreservedBitmap(320, 180);
-	data->pixelator = CreateNotPreservedBitmap(320, 180);
-	data->checkerboard = al_create_bitmap(320, 180);
+	data->bitmap = TrackBitmap(game, MEMORY_BITMAPS, CreateNotPreservedBitmap(320, 180));
+	data->pixelator = TrackBitmap(game, MEMORY_BITMAPS, CreateNotPreservedBitmap(320, 180));
+	data->checkerboard = TrackBitmap(game, MEMORY_BITMAPS, al_create_bitmap(320, 180));
 	(*progress)(game);
 
-	data->font = al_load_ttf_font(GetDataFilePath(game, "fonts/DejaVuSansMono.ttf"),
-		(int)(180 * 0.1666 / 8) * 8, 0);
-	(*progress)(game);
+	FinishLoadJobs(game, loader, progress);
+	data->font = jobs[0].result;
+	data->sample = jobs[1].result;
+	data->kbd_sample = jobs[2].result;
+	data->key_sample = jobs[3].result;
 
-	data->sample = al_load_sample(GetDataFilePath(game, "dosowisko.flac"));
 	data->sound = al_create_sample_instance(data->sample);
 	al_attach_sample_instance_to_mixer(data->sound, game->audio.music);
 	al_set_sample_instance_playmode(data->sound, ALLEGRO_PLAYMODE_ONCE);
-	(*progress)(game);
 
-	data->kbd_sample = al_load_sample(GetDataFilePath(game, "kbd.flac"));
 	data->kbd = al_create_sample_instance(data->kbd_sample);
 	al_attach_sample_instance_to_mixer(data->kbd, game->audio.fx);
 	al_set_sample_instance_playmode(data->kbd, ALLEGRO_PLAYMODE_ONCE);
-	(*progress)(game);
 
-	data->key_sample = al_load_sample(GetDataFilePath(game, "key.flac"));
 	data->key = al_create_sample_instance(data->key_sample);
 	al_attach_sample_instance_to_mixer(data->key, game->audio.fx);
 	al_set_sample_instance_playmode(data->key, ALLEGRO_PLAYMODE_ONCE);
-	(*progress)(game);
 
 	al_set_new_bitmap_flags(flags);
 
@@ -205,6 +215,7 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 }
 
 void Gamestate_PostLoad(struct Game* game, struct GamestateResources* data) {
+	WarmupGlyphs(game, data->font, "intro", (const char*[]){text, "_", NULL});
 	al_set_target_bitmap(data->checkerboard);
 	al_lock_bitmap(data->checkerboard, ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_WRITEONLY);
 	int x, y;
@@ -224,19 +235,23 @@ void Gamestate_Stop(struct Game* game, struct GamestateResources* data) {
 	al_stop_sample_instance(data->sound);
 	al_stop_sample_instance(data->kbd);
 	al_stop_sample_instance(data->key);
+	RecordAudioEvent(game, "sound dosowisko stop");
+	RecordAudioEvent(game, "sound kbd stop");
+	RecordAudioEvent(game, "sound key stop");
 }
 
 void Gamestate_Unload(struct Game* game, struct GamestateResources* data) {
+	ClearTextCache(game, data->font);
 	al_destroy_font(data->font);
 	al_destroy_sample_instance(data->sound);
-	al_destroy_sample(data->sample);
+	DestroyTrackedSample(game, data->sample);
 	al_destroy_sample_instance(data->kbd);
-	al_destroy_sample(data->kbd_sample);
+	DestroyTrackedSample(game, data->kbd_sample);
 	al_destroy_sample_instance(data->key);
-	al_destroy_sample(data->key_sample);
-	al_destroy_bitmap(data->bitmap);
-	al_destroy_bitmap(data->checkerboard);
-	al_destroy_bitmap(data->pixelator);
+	DestroyTrackedSample(game, data->key_sample);
+	DestroyTrackedBitmap(game, MEMORY_BITMAPS, data->bitmap);
+	DestroyTrackedBitmap(game, MEMORY_BITMAPS, data->checkerboard);
+	DestroyTrackedBitmap(game, MEMORY_BITMAPS, data->pixelator);
 	TM_Destroy(data->timeline);
 	free(data);
 }
@@ -84,6 +84,11 @@ static char* FILES[20] = {
 	"voice/stairs6.flac",
 };
 
+struct TouchArea {
+	bool active, steering;
+	float x, y;
+};
+
 struct GamestateResources {
 	// This struct is for every resource allocated and used by your gamestate.
 	// It gets created on load and then gets passed around to all other function calls.
@@ -95,115 +100,111 @@ struct GamestateResources {
 	bool up, down;
 	bool w, a, s, d;
 	bool touch;
+	struct InputState input;
+	struct {
+		struct TouchArea stick, buttons;
+		bool moved; // since the last tick
+		uint16_t actions;
+	} touchpad;
+	bool late_latch; // controls drawn from the freshest input rather than from what the last tick saw
+	struct {
+		double since; // oldest input event whose effect isn't on screen yet
+		uint16_t ticked, drawn; // actions as of the last tick and the last frame
+	} latency;
 
 	bool growlock, pivotlock, inputlock;
 	bool upped, downed, pivoted, triedtomove, shown;
 
-	struct Timeline* timeline;
+	struct Script narration;
+	int start_label;
 
 	int current_voice;
 	int fab_voice;
+	struct {
+		int voice, line; // subtitle shown last, so the lookup can continue from there
+	} subtitle;
 
 	int level;
 	int die_counter;
 
 	bool isthisit_triggered;
 
-	struct {
-		ALLEGRO_SAMPLE* sample;
-		ALLEGRO_SAMPLE_INSTANCE* instance;
-		int id;
-	} voices[17];
+	ALLEGRO_AUDIO_STREAM* voice; // of current_voice
+	struct AudioPrefetch* prefetch;
 };
 
-int Gamestate_ProgressCount = 18; // number of loading steps as reported by Gamestate_Load; 0 when missing
-
-static TM_ACTION(WaitForVoice) {
-	TM_RunningOnly;
-	if (data->current_voice >= 0) {
-		return !al_get_sample_instance_playing(data->voices[data->current_voice].instance);
-	}
-	return false;
-}
-
-static TM_ACTION(WaitForTryMove) {
-	TM_RunningOnly;
-	return data->triedtomove;
-}
-
-static TM_ACTION(WaitForPivoted) {
-	TM_RunningOnly;
-	return data->pivoted;
-}
-
-static TM_ACTION(WaitForUpped) {
-	TM_RunningOnly;
-	return data->upped;
-}
-
-static TM_ACTION(WaitForDowned) {
-	TM_RunningOnly;
-	return data->downed;
-}
-
-static TM_ACTION(UnlockInput) {
-	TM_RunningOnly;
-	data->inputlock = false;
-	return true;
-}
-
-static TM_ACTION(UnlockGrow) {
-	TM_RunningOnly;
-	data->growlock = false;
-	return true;
-}
+int Gamestate_ProgressCount = 2; // number of loading steps as reported by Gamestate_Load; 0 when missing
 
-static TM_ACTION(ShowStuff) {
-	TM_RunningOnly;
-	data->shown = true;
-	return true;
+static int NextFabVoice(int voice) {
+	voice++;
+	return voice == 9 ? 11 : voice;
 }
 
-static TM_ACTION(UnlockPivot) {
-	TM_RunningOnly;
-	data->pivotlock = false;
-	return true;
+static void PredictVoices(struct Game* game, struct GamestateResources* data) {
+	// Lines play in a fixed order, interrupted only by the death lines, so both candidates get opened in advance.
+	int next = NextFabVoice(data->fab_voice);
+	if (next < 17) {
+		PrefetchAudioStream(game, data->prefetch, FILES[next]);
+	}
+	if (data->die_counter < 2) {
+		PrefetchAudioStream(game, data->prefetch, FILES[9 + data->die_counter]);
+	}
 }
 
-static TM_ACTION(PlayNextVoice) {
-	TM_RunningOnly;
-	data->fab_voice++;
-	if (data->fab_voice == 9) {
-		data->fab_voice = 11;
+static void StopVoice(struct Game* game, struct GamestateResources* data) {
+	if (!data->voice) {
+		return;
 	}
-	data->current_voice = data->fab_voice;
-	if (data->current_voice < 17) {
-		al_play_sample_instance(data->voices[data->current_voice].instance);
+	if (game->data->narration == data->voice) {
+		SetNarration(game, NULL);
 	}
-	return true;
+	DestroyTrackedAudioStream(game, data->voice);
+	data->voice = NULL;
 }
 
-static TM_ACTION(JustDied1) {
-	TM_RunningOnly;
-	data->current_voice = 9;
-	al_play_sample_instance(data->voices[data->current_voice].instance);
-	return true;
+static void PlayVoice(struct Game* game, struct GamestateResources* data, int voice) {
+	StopVoice(game, data);
+	data->current_voice = voice;
+	data->voice = TakeAudioStream(game, data->prefetch, FILES[voice]);
+	if (data->voice) {
+		al_attach_audio_stream_to_mixer(data->voice, game->audio.voice);
+		al_set_audio_stream_playing(data->voice, true);
+	}
+	SetNarration(game, data->voice);
+	if (IsCapturing()) {
+		char source[1024];
+		GetDataFileSource(game, FILES[voice], source, sizeof(source));
+		RecordAudioEvent(game, "voice %d play %s", voice, source);
+	}
+	PredictVoices(game, data);
 }
 
-static TM_ACTION(JustDied2) {
-	TM_RunningOnly;
-	data->current_voice = 10;
-	al_play_sample_instance(data->voices[data->current_voice].instance);
-	return true;
+static void ScriptVoice(struct Game* game, void* d, int voice) {
+	struct GamestateResources* data = d;
+	if (voice < 0) {
+		data->fab_voice = NextFabVoice(data->fab_voice);
+		voice = data->fab_voice;
+	}
+	data->current_voice = voice;
+	if (voice < 17) {
+		PlayVoice(game, data, voice);
+	}
 }
 
 static void DestroyPhysics(struct Game* game, struct GamestateResources* data) {
 	for (int i = 0; i < data->entity_num; i++) {
 		vrWorldRemoveBody(data->world, data->entities[i]->body);
 		free(data->entities[i]);
+		ReleaseMemory(game, MEMORY_PHYSICS, ENTITY_FOOTPRINT);
+	}
+	if (data->player) {
+		// its body stays in the world and goes with it
+		free(data->player);
+		ReleaseMemory(game, MEMORY_PHYSICS, ENTITY_FOOTPRINT);
 	}
 	if (data->world) {
 		vrWorldDestroy(data->world);
+		ReleaseMemory(game, MEMORY_PHYSICS, sizeof(vrWorld));
 		data->world = NULL;
 	}
 	data->entity_num = 0;
@@ -241,12 +242,18 @@ static void StartLevel(struct Game* game, struct GamestateResources* data, int l
 	DestroyPhysics(game, data);
 
 	data->world = vrWorldInit(vrWorldAlloc());
+	TrackMemory(game, MEMORY_PHYSICS, sizeof(vrWorld));
 	data->world->gravity = vrVect(0, 9.81);
 
 	Start(game, data);
 
 	data->entity_num = 0;
 
+	if (level == 4) {
+		// the last one, heaven comes next
+		PreloadGamestate(game, "heaven");
+	}
+
 	if (level == 0) {
 		PushEntity(game, data, CreateEntity(game, data->world, 0, 600, 1920, 50, -1, 1, 0, false, 0));
 		CreateExit(game, data, 1920 - 200, 600 - 200);
@@ -329,10 +336,16 @@ static void Restart(struct Game* game, struct GamestateResources* data) {
 	StartLevel(game, data, data->level);
 }
 
+static void TickGame(struct Game* game, struct GamestateResources* data);
+
 void Gamestate_Logic(struct Game* game, struct GamestateResources* data, double delta) {
 	// Here you should do all your game logic as if <delta> seconds have passed.
 	//vrWorldStep(data->world);
-	TM_Process(data->timeline, delta);
+	if (IsCapturing()) {
+		// exactly one tick per captured frame, as the engine would fit in as many as the frame took
+		TickGame(game, data);
+	}
+	RunScript(game, &data->narration, GetLogicDelta(delta));
 	game->data->hud.enabled = data->touch && !data->inputlock;
 	game->data->hud.wasd = !data->pivotlock;
 	game->data->hud.updown = !data->growlock;
@@ -345,41 +358,127 @@ void Gamestate_Logic(struct Game* game, struct GamestateResources* data, double
 }
 
 static void Win(struct Game* game, struct GamestateResources* data) {
-	if (data->level + 1 == 1) {
-		TM_AddAction(data->timeline, PlayNextVoice, NULL);
-		TM_AddAction(data->timeline, WaitForVoice, NULL);
+	char label[16];
+	snprintf(label, sizeof(label), "level%d", data->level + 1);
+	QueueScript(&data->narration, FindScriptLabel(&data->narration, label));
+	if (data->level + 1 == 5) {
+		SwitchCurrentGamestate(game, "heaven");
+	}
+	StartLevel(game, data, data->level + 1);
+}
+
+static uint16_t TouchActions(struct Game* game, struct GamestateResources* data) {
+	if (!data->touchpad.moved) {
+		return data->touchpad.actions;
+	}
+	double x = game->clip_rect.h / 1080.0;
+	int width = al_get_display_width(game->display);
+	int height = al_get_display_height(game->display);
+	struct TouchArea* stick = &data->touchpad.stick;
+	struct TouchArea* buttons = &data->touchpad.buttons;
+	uint16_t actions = 0;
+
+	if (stick->active && (stick->steering || ((stick->x < 340 * x) && (stick->y > height - 340 * x)))) {
+		// once it started in the circle, it keeps steering wherever it goes
+		stick->steering = true;
+		double angle = atan2(stick->y - (height - 170 * x), stick->x - 170 * x);
+		if ((angle > -ALLEGRO_PI / 4.0 - 0.333) && (angle < ALLEGRO_PI / 4.0 + 0.333)) {
+			actions |= INPUT_BIT(INPUT_D);
+		}
+		if ((angle > ALLEGRO_PI / 4.0 - 0.333) && (angle < 3 * ALLEGRO_PI / 4.0 + 0.333)) {
+			actions |= INPUT_BIT(INPUT_S);
+		}
+		if ((angle > 3 * ALLEGRO_PI / 4.0 - 0.333) || (angle < -3 * ALLEGRO_PI / 4.0 + 0.333)) {
+			actions |= INPUT_BIT(INPUT_A);
+		}
+		if ((angle > -3 * ALLEGRO_PI / 4.0 - 0.333) && (angle < -ALLEGRO_PI / 4.0 + 0.333)) {
+			actions |= INPUT_BIT(INPUT_W);
+		}
 	}
-	if (data->level + 1 == 3) {
-		TM_AddAction(data->timeline, PlayNextVoice, NULL);
-		TM_AddAction(data->timeline, WaitForVoice, NULL);
+	if (buttons->active && (buttons->x > width - 190 * x) && (buttons->y < 420 * x)) {
+		actions |= INPUT_BIT(buttons->y < 190 * x ? INPUT_UP : INPUT_DOWN);
 	}
-	if (data->level + 1 == 4) {
-		TM_AddAction(data->timeline, PlayNextVoice, NULL);
-		TM_AddAction(data->timeline, WaitForVoice, NULL);
-		TM_AddDelay(data->timeline, 2);
-		TM_AddAction(data->timeline, PlayNextVoice, NULL);
-		TM_AddAction(data->timeline, WaitForVoice, NULL);
 
-		TM_AddDelay(data->timeline, 4);
-		TM_AddAction(data->timeline, PlayNextVoice, NULL);
-		TM_AddAction(data->timeline, WaitForVoice, NULL);
+	data->touchpad.actions = actions;
+	data->touchpad.moved = false;
+	return actions;
+}
 
-		TM_AddDelay(data->timeline, 2);
-		TM_AddAction(data->timeline, PlayNextVoice, NULL);
-		TM_AddAction(data->timeline, WaitForVoice, NULL);
+static uint16_t LatchInput(struct Game* game, struct GamestateResources* data, bool* tried) {
+	// held actions, minus whatever's still locked; tried gets set when a locked one was attempted
+	const uint16_t grow = INPUT_BIT(INPUT_UP) | INPUT_BIT(INPUT_DOWN);
+	const uint16_t pivot = INPUT_BIT(INPUT_W) | INPUT_BIT(INPUT_A) | INPUT_BIT(INPUT_S) | INPUT_BIT(INPUT_D);
+	uint16_t held = data->inputlock ? 0 : UpdateInput(game, &data->input) | TouchActions(game, data);
+	if (tried) {
+		*tried = (data->growlock && (held & grow)) || (data->pivotlock && (held & pivot));
+	}
+	if (data->growlock) {
+		held &= ~grow;
+	}
+	if (data->pivotlock) {
+		held &= ~pivot;
+	}
+	return held;
+}
 
-		TM_AddDelay(data->timeline, 5);
-		TM_AddAction(data->timeline, PlayNextVoice, NULL);
-		TM_AddAction(data->timeline, WaitForVoice, NULL);
+static void ApplyInput(struct Game* game, struct GamestateResources* data) {
+	bool tried;
+	uint16_t held = LatchInput(game, data, &tried);
+	data->up = held & INPUT_BIT(INPUT_UP);
+	data->down = held & INPUT_BIT(INPUT_DOWN);
+	data->w = held & INPUT_BIT(INPUT_W);
+	data->a = held & INPUT_BIT(INPUT_A);
+	data->s = held & INPUT_BIT(INPUT_S);
+	data->d = held & INPUT_BIT(INPUT_D);
+
+	// the narration may be waiting for any of these, so it gets woken up as soon as one gets set
+	if (tried && !data->triedtomove) {
+		data->triedtomove = true;
+		SignalScripts(game, &data->triedtomove);
 	}
-	if (data->level + 1 == 5) {
-		SwitchCurrentGamestate(game, "heaven");
+	if (data->up && !data->upped) {
+		data->upped = true;
+		SignalScripts(game, &data->upped);
 	}
-	StartLevel(game, data, data->level + 1);
+	if (data->down && !data->downed) {
+		data->downed = true;
+		SignalScripts(game, &data->downed);
+	}
+	if ((data->w || data->a || data->s || data->d) && !data->pivoted) {
+		data->pivoted = true;
+		SignalScripts(game, &data->pivoted);
+	}
+
+	if (!data->late_latch && held == data->latency.ticked) {
+		// whatever came in didn't change anything that gets drawn
+		data->latency.since = 0;
+	}
+	data->latency.ticked = held;
 }
 
-void Gamestate_Tick(struct Game* game, struct GamestateResources* data) {
-	// Here you should do all your game logic as if <delta> seconds have passed.
+static void MovePivot(float* x, float* y, float orientation, uint16_t held) {
+	if (held & INPUT_BIT(INPUT_A)) {
+		*y += 0.0333 * sin(orientation);
+		*x -= 0.0333 * cos(orientation);
+	}
+	if (held & INPUT_BIT(INPUT_D)) {
+		*y -= 0.0333 * sin(orientation);
+		*x += 0.0333 * cos(orientation);
+	}
+	if (held & INPUT_BIT(INPUT_W)) {
+		*x -= 0.0333 * sin(orientation);
+		*y -= 0.0333 * cos(orientation);
+	}
+	if (held & INPUT_BIT(INPUT_S)) {
+		*x += 0.0333 * sin(orientation);
+		*y += 0.0333 * cos(orientation);
+	}
+	*x = fmin(1.0, fmax(0.0, *x));
+	*y = fmin(1.0, fmax(0.0, *y));
+}
+
+static void TickGame(struct Game* game, struct GamestateResources* data) {
+	ApplyInput(game, data);
 
 	game->data->tint = al_map_rgba_f(0.75, 0.85, 0.85, 0.85);
 	if (data->up || data->down) {
@@ -410,47 +509,14 @@ void Gamestate_Tick(struct Game* game, struct GamestateResources* data) {
 		data->world->timeStep = 1.0 / 60.0;
 	}
 
-	if (data->a) {
-		data->player->pivotY += 0.0333 * sin(data->player->body->orientation);
-		data->player->pivotX -= 0.0333 * cos(data->player->body->orientation);
-	}
-	if (data->d) {
-		data->player->pivotY -= 0.0333 * sin(data->player->body->orientation);
-		data->player->pivotX += 0.0333 * cos(data->player->body->orientation);
-	}
-	if (data->w) {
-		data->player->pivotX -= 0.0333 * sin(data->player->body->orientation);
-		data->player->pivotY -= 0.0333 * cos(data->player->body->orientation);
-	}
-	if (data->s) {
-		data->player->pivotX += 0.0333 * sin(data->player->body->orientation);
-		data->player->pivotY += 0.0333 * cos(data->player->body->orientation);
-	}
-
-	if (data->player->pivotX > 1.0) {
-		data->player->pivotX = 1.0;
-	}
-	if (data->player->pivotX < 0.0) {
-		data->player->pivotX = 0.0;
-	}
-	if (data->player->pivotY > 1.0) {
-		data->player->pivotY = 1.0;
-	}
-	if (data->player->pivotY < 0.0) {
-		data->player->pivotY = 0.0;
-	}
+	MovePivot(&data->player->pivotX, &data->player->pivotY, data->player->body->orientation, data->latency.ticked);
 
 	if (data->player->body->center.y > 1600) {
 		Restart(game, data);
-		if (TM_IsEmpty(data->timeline)) {
-			data->die_counter++;
-			if (data->die_counter == 1) {
-				TM_AddAction(data->timeline, JustDied1, NULL);
-				TM_AddAction(data->timeline, WaitForVoice, NULL);
-			} else if (data->die_counter == 2) {
-				TM_AddAction(data->timeline, JustDied2, NULL);
-				TM_AddAction(data->timeline, WaitForVoice, NULL);
-			}
+		if (data->narration.pc < 0) {
+			char label[16];
+			snprintf(label, sizeof(label), "death%d", ++data->die_counter);
+			QueueScript(&data->narration, FindScriptLabel(&data->narration, label));
 		}
 	}
 
@@ -484,63 +550,100 @@ void Gamestate_Tick(struct Game* game, struct GamestateResources* data) {
 		if (!data->isthisit_triggered) {
 			if (data->player->body->center.x > 1920 * 0.75 && data->player->body->center.y < 1080 * 0.3) {
 				data->isthisit_triggered = true;
-				TM_AddAction(data->timeline, PlayNextVoice, NULL);
-				TM_AddAction(data->timeline, WaitForVoice, NULL);
+				QueueScript(&data->narration, FindScriptLabel(&data->narration, "isthisit"));
 			}
 		}
 	}
 }
 
+void Gamestate_Tick(struct Game* game, struct GamestateResources* data) {
+	// Called at a fixed rate; captures step it from Gamestate_Logic instead.
+	if (!IsCapturing()) {
+		TickGame(game, data);
+	}
+}
+
+static void DrawExit(struct Game* game, void* d) {
+	// The exit keeps pulsing, so it's drawn over the scene instead of into it; otherwise a level that's
+	// shown would never have two identical frames in a row. It ends up over the player, which only
+	// gets near it on the way out.
+	struct GamestateResources* data = d;
+	if (!data->world || !data->exit || !data->shown) {
+		return;
+	}
+	float c = 0.9 - sin(game->time * 4) * 0.1;
+	al_draw_rectangle(data->exit->body->center.x - 100, data->exit->body->center.y - 100, data->exit->body->center.x + 100, data->exit->body->center.y + 100, al_map_rgb_f(c, c * 1.1, c * 1.1), 5);
+
+	al_draw_rectangle(data->exit->body->center.x - 100 + 8, data->exit->body->center.y - 100 + 8, data->exit->body->center.x + 100 - 8, data->exit->body->center.y + 100 - 8, al_map_rgb_f(c, c * 1.1, c * 1.1), 4);
+	al_draw_rectangle(data->exit->body->center.x - 100 + 15, data->exit->body->center.y - 100 + 15, data->exit->body->center.x + 100 - 15, data->exit->body->center.y + 100 - 15, al_map_rgb_f(c, c * 1.1, c * 1.1), 3);
+	al_draw_rectangle(data->exit->body->center.x - 100 + 21, data->exit->body->center.y - 100 + 21, data->exit->body->center.x + 100 - 21, data->exit->body->center.y + 100 - 21, al_map_rgb_f(c, c * 1.1, c * 1.1), 2);
+	al_draw_rectangle(data->exit->body->center.x - 100 + 26, data->exit->body->center.y - 100 + 26, data->exit->body->center.x + 100 - 26, data->exit->body->center.y + 100 - 26, al_map_rgb_f(c, c * 1.1, c * 1.1), 1);
+}
+
 void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
 	// Draw everything to the screen here.
+	uint16_t shown = data->late_latch ? LatchInput(game, data, NULL) : data->latency.ticked;
+	if (shown != data->latency.drawn && data->latency.since) {
+		MarkInputShown(game, data->latency.since);
+	}
+	if (shown != data->latency.drawn || data->late_latch) {
+		data->latency.since = 0;
+	}
+	data->latency.drawn = shown;
+	bool growing = shown & (INPUT_BIT(INPUT_UP) | INPUT_BIT(INPUT_DOWN));
 
 	ClearToColor(game, al_map_rgba(0, 0, 0, 0));
 
 	if (!data->world || !data->exit || !data->player) {
+		SubmitFrameSignature(game);
 		return;
 	}
 
+	AddFrameSignature(game, &data->shown, sizeof(data->shown));
+
 	if (data->shown) {
 		for (int i = 0; i < data->entity_num; i++) {
 			DrawEntity(game, data->entities[i]);
 		}
-
-		float c = 0.9 - sin(game->time * 4) * 0.1;
-		al_draw_rectangle(data->exit->body->center.x - 100, data->exit->body->center.y - 100, data->exit->body->center.x + 100, data->exit->body->center.y + 100, al_map_rgb_f(c, c * 1.1, c * 1.1), 5);
-
-		al_draw_rectangle(data->exit->body->center.x - 100 + 8, data->exit->body->center.y - 100 + 8, data->exit->body->center.x + 100 - 8, data->exit->body->center.y + 100 - 8, al_map_rgb_f(c, c * 1.1, c * 1.1), 4);
-		al_draw_rectangle(data->exit->body->center.x - 100 + 15, data->exit->body->center.y - 100 + 15, data->exit->body->center.x + 100 - 15, data->exit->body->center.y + 100 - 15, al_map_rgb_f(c, c * 1.1, c * 1.1), 3);
-		al_draw_rectangle(data->exit->body->center.x - 100 + 21, data->exit->body->center.y - 100 + 21, data->exit->body->center.x + 100 - 21, data->exit->body->center.y + 100 - 21, al_map_rgb_f(c, c * 1.1, c * 1.1), 2);
-		al_draw_rectangle(data->exit->body->center.x - 100 + 26, data->exit->body->center.y - 100 + 26, data->exit->body->center.x + 100 - 26, data->exit->body->center.y + 100 - 26, al_map_rgb_f(c, c * 1.1, c * 1.1), 1);
 	}
 
 	DrawEntity(game, data->player);
-	if (data->up || data->down) {
+	if (growing) {
+		AddFrameSignature(game, &data->player->body->center, sizeof(data->player->body->center));
+		AddFrameSignature(game, &data->player->body->velocity, sizeof(data->player->body->velocity));
 		al_draw_filled_circle(data->player->body->center.x, data->player->body->center.y, 8, al_map_rgb(10, 200, 200));
 
 		al_draw_line(data->player->body->center.x, data->player->body->center.y,
 			data->player->body->center.x + data->player->body->velocity.x / 8.0, data->player->body->center.y + data->player->body->velocity.y / 8.0,
 			al_map_rgb(10, 200, 200), 2);
 	}
-	if ((!data->pivotlock) && (data->up || data->down || data->w || data->a || data->s || data->d)) {
-		vrVec2 pivot = GetPivot(data->player);
+	const uint16_t moving = INPUT_BIT(INPUT_UP) | INPUT_BIT(INPUT_DOWN) | INPUT_BIT(INPUT_W) | INPUT_BIT(INPUT_A) | INPUT_BIT(INPUT_S) | INPUT_BIT(INPUT_D);
+	if ((!data->pivotlock) && (shown & moving)) {
+		struct Entity player = *data->player;
+		if (data->late_latch) {
+			// where the next tick is going to put it
+			MovePivot(&player.pivotX, &player.pivotY, player.body->orientation, shown);
+		}
+		vrVec2 pivot = GetPivot(&player);
+		AddFrameSignature(game, &pivot, sizeof(pivot));
 		al_draw_filled_circle(pivot.x, pivot.y, 8, al_map_rgb(200, 200, 40));
 	}
 
 	if (data->current_voice >= 0) {
-		if (al_get_sample_instance_playing(data->voices[data->current_voice].instance)) {
-			float pos = al_get_sample_instance_position(data->voices[data->current_voice].instance) / (float)al_get_sample_instance_length(data->voices[data->current_voice].instance) * al_get_sample_instance_time(data->voices[data->current_voice].instance);
+		if (data->voice && al_get_audio_stream_playing(data->voice)) {
+			float pos = GetAudioStreamPlayedSecs(data->voice);
 			//PrintConsole(game, "%f", pos);
-			int i = 0;
-			char* txt = "";
-			while (LABELS[data->current_voice][i]) {
-				if (pos >= POSITIONS[data->current_voice][i]) {
-					txt = LABELS[data->current_voice][i];
-				}
-				i++;
+			if (data->subtitle.voice != data->current_voice || (data->subtitle.line >= 0 && pos < POSITIONS[data->current_voice][data->subtitle.line])) {
+				data->subtitle.voice = data->current_voice;
+				data->subtitle.line = -1;
+			}
+			while (LABELS[data->current_voice][data->subtitle.line + 1] && pos >= POSITIONS[data->current_voice][data->subtitle.line + 1]) {
+				data->subtitle.line++;
 			}
+			char* txt = data->subtitle.line >= 0 ? LABELS[data->current_voice][data->subtitle.line] : "";
 
-			int width = al_get_text_width(game->data->font, txt);
+			struct CachedText* line = CacheText(game, game->data->font, txt, 0, 0, TEXT_SHADOW);
+			float width = line->width;
 
 			float x = data->player->body->center.x + data->player->width * sqrt(2) / 2;
 			float y = data->player->body->center.y - 40;
@@ -548,19 +651,25 @@ void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
 			x = fmin(1910, fmax(10, x));
 			y = fmin(1000, fmax(10, y));
 
+			AddFrameSignature(game, &txt, sizeof(txt));
+			AddFrameSignature(game, &x, sizeof(x));
+			AddFrameSignature(game, &y, sizeof(y));
+
 			if ((x > 1920 / 2.0) && (x + width > 1920)) {
 				x = data->player->body->center.x - data->player->width * sqrt(2) / 2;
-				al_draw_multiline_text(game->data->font, al_map_rgb(255, 255, 255), x, y, x, 64, ALLEGRO_ALIGN_RIGHT, txt);
+				DrawCachedText(game, CacheText(game, game->data->font, txt, x, 64, ALLEGRO_ALIGN_RIGHT), al_map_rgb(255, 255, 255), x, y);
 			} else {
 				if (x + width > 1920) {
-					al_draw_multiline_text(game->data->font, al_map_rgb(255, 255, 255), x, y, 1920 - x, 64, ALLEGRO_ALIGN_LEFT, txt);
+					DrawCachedText(game, CacheText(game, game->data->font, txt, 1920 - x, 64, ALLEGRO_ALIGN_LEFT), al_map_rgb(255, 255, 255), x, y);
 				} else {
-					DrawTextWithShadow(game->data->font, al_map_rgb(255, 255, 255), x, y, ALLEGRO_ALIGN_LEFT, txt);
+					DrawCachedText(game, line, al_map_rgb(255, 255, 255), x, y);
 				}
 			}
 		}
 	}
 
+	SubmitFrameSignature(game);
+
 	//al_draw_filled_rectangle(pivot.x - 1, pivot.y - 1, pivot.x + 1, pivot.y + 1, al_map_rgb(255, 0, 0));
 
 	/*	DrawEntity(game, data->walls[0]);
@@ -573,22 +682,20 @@ void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
 void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data, ALLEGRO_EVENT* ev) {
 	// Called for each event in Allegro event queue.
 	// Here you can handle user input, expiring timers etc.
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_ESCAPE)) {
+	// Held actions only get recorded here; ApplyInput turns them into movement once per tick.
+	uint16_t held = data->input.keys | data->input.buttons;
+	uint16_t pressed = ProcessInputEvent(game, &data->input, ev);
+	bool touched = ev->type == ALLEGRO_EVENT_TOUCH_BEGIN || ev->type == ALLEGRO_EVENT_TOUCH_END;
+	if (!data->latency.since && (held != (data->input.keys | data->input.buttons) || touched)) {
+		// axes and touch moves change continuously, so only presses and releases get measured
+		data->latency.since = ev->any.timestamp;
+	}
+
+	if (pressed & INPUT_BIT(INPUT_QUIT)) {
 		UnloadCurrentGamestate(game); // mark this gamestate to be stopped and unloaded
 		// When there are no active gamestates, the engine will quit.
 	}
 
-	int skipbtn = 6;
-#ifdef __SWITCH__
-	skipbtn = 11;
-#endif
-#ifdef ALLEGRO_MACOSX
-	skipbtn = 9;
-#endif
-#ifdef ALLEGRO_WINDOWS
-	skipbtn = 8;
-#endif
-
 	if (ev->type == ALLEGRO_EVENT_TOUCH_BEGIN) {
 		data->touch = true;
 	}
@@ -596,352 +703,40 @@ void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data,
 		data->touch = false;
 	}
 
-	if (((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_FULLSTOP)) || ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == skipbtn))) {
-		if (data->current_voice >= 0) {
-			al_set_sample_instance_playing(data->voices[data->current_voice].instance, false);
-		}
-	}
-
-	if (game->config.debug.enabled) {
-		if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_ENTER)) {
-			Win(game, data);
-		}
-	}
-
-	if (data->inputlock) {
-		return;
-	}
-
-	if (((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_BACKSPACE)) || ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == 1))) {
-		if (data->shown) {
-			Restart(game, data);
-		}
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_DOWN)) {
-		data->down = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_UP)) {
-		data->up = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_KEY_UP) && (ev->keyboard.keycode == ALLEGRO_KEY_DOWN)) {
-		data->down = false;
-	}
-	if ((ev->type == ALLEGRO_EVENT_KEY_UP) && (ev->keyboard.keycode == ALLEGRO_KEY_UP)) {
-		data->up = false;
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_W)) {
-		data->w = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_KEY_UP) && (ev->keyboard.keycode == ALLEGRO_KEY_W)) {
-		data->w = false;
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_A)) {
-		data->a = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_KEY_UP) && (ev->keyboard.keycode == ALLEGRO_KEY_A)) {
-		data->a = false;
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_S)) {
-		data->s = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_KEY_UP) && (ev->keyboard.keycode == ALLEGRO_KEY_S)) {
-		data->s = false;
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_D)) {
-		data->d = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_KEY_UP) && (ev->keyboard.keycode == ALLEGRO_KEY_D)) {
-		data->d = false;
-	}
-
-#ifdef __SWITCH__
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == 13)) {
-		data->w = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP) && (ev->joystick.button == 13)) {
-		data->w = false;
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == 12)) {
-		data->a = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP) && (ev->joystick.button == 12)) {
-		data->a = false;
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == 15)) {
-		data->s = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP) && (ev->joystick.button == 15)) {
-		data->s = false;
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == 14)) {
-		data->d = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP) && (ev->joystick.button == 14)) {
-		data->d = false;
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == 8)) {
-		data->up = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP) && (ev->joystick.button == 8)) {
-		data->up = false;
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == 9)) {
-		data->down = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP) && (ev->joystick.button == 9)) {
-		data->down = false;
-	}
-#endif
-
-#ifdef ALLEGRO_MACOSX
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == 11)) {
-		data->w = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP) && (ev->joystick.button == 11)) {
-		data->w = false;
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == 13)) {
-		data->a = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP) && (ev->joystick.button == 13)) {
-		data->a = false;
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == 12)) {
-		data->s = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP) && (ev->joystick.button == 12)) {
-		data->s = false;
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == 14)) {
-		data->d = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP) && (ev->joystick.button == 14)) {
-		data->d = false;
-	}
-#endif
-
-#ifdef ALLEGRO_WINDOWS
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == 13)) {
-		data->w = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP) && (ev->joystick.button == 13)) {
-		data->w = false;
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == 11)) {
-		data->a = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP) && (ev->joystick.button == 11)) {
-		data->a = false;
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == 12)) {
-		data->s = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP) && (ev->joystick.button == 12)) {
-		data->s = false;
-	}
-
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) && (ev->joystick.button == 10)) {
-		data->d = true;
-	}
-	if ((ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP) && (ev->joystick.button == 10)) {
-		data->d = false;
-	}
-#endif
-
-	if (ev->type == ALLEGRO_EVENT_JOYSTICK_AXIS) {
-		if (game->config.debug.verbose) {
-			PrintConsole(game, "id0 %d stick: %d axis %d pos %f", al_get_joystick(0) == ev->joystick.id, ev->joystick.stick, ev->joystick.axis, ev->joystick.pos);
-		}
-	}
-
-	if (ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN) {
-		if (game->config.debug.verbose) {
-			PrintConsole(game, "id0 %d button down: %d", al_get_joystick(0) == ev->joystick.id, ev->joystick.button);
+	if (pressed & INPUT_BIT(INPUT_SKIP)) {
+		if (data->voice) {
+			al_set_audio_stream_playing(data->voice, false);
+			RecordAudioEvent(game, "voice %d stop", data->current_voice);
 		}
 	}
 
-	if (ev->type == ALLEGRO_EVENT_JOYSTICK_AXIS && ev->joystick.stick == 1) {
-		if (ev->joystick.axis == 1) {
-			if (ev->joystick.pos < -0.25) {
-				data->up = true;
-			} else {
-				data->up = false;
-			}
-			if (ev->joystick.pos > 0.25) {
-				data->down = true;
-			} else {
-				data->down = false;
-			}
-		}
-	}
-	if (ev->type == ALLEGRO_EVENT_JOYSTICK_AXIS && ev->joystick.stick == 0) {
-		if (ev->joystick.axis == 1) {
-			if (ev->joystick.pos < -0.25) {
-				data->w = true;
-			} else {
-				data->w = false;
-			}
-			if (ev->joystick.pos > 0.25) {
-				data->s = true;
-			} else {
-				data->s = false;
-			}
-		}
-		if (ev->joystick.axis == 0) {
-			if (ev->joystick.pos < -0.25) {
-				data->a = true;
-			} else {
-				data->a = false;
-			}
-			if (ev->joystick.pos > 0.25) {
-				data->d = true;
-			} else {
-				data->d = false;
-			}
-		}
+	if (game->config.debug.enabled && (pressed & INPUT_BIT(INPUT_WIN))) {
+		Win(game, data);
 	}
 
-#ifndef ALLEGRO_WINDOWS
-	if (ev->type == ALLEGRO_EVENT_JOYSTICK_AXIS && ev->joystick.stick == 2) {
-		if (ev->joystick.axis == 0) {
-			if (ev->joystick.pos > -1) {
-				data->up = true;
-			} else {
-				data->up = false;
-			}
-		}
-		if (ev->joystick.axis == 1) {
-			if (ev->joystick.pos > -1) {
-				data->down = true;
-			} else {
-				data->down = false;
-			}
-		}
+	if (ev->type == ALLEGRO_EVENT_TOUCH_BEGIN || ev->type == ALLEGRO_EVENT_TOUCH_MOVE || ev->type == ALLEGRO_EVENT_TOUCH_END || ev->type == ALLEGRO_EVENT_TOUCH_CANCEL) {
+		// the left half steers, the right one grows and shrinks; only the last position of each counts
+		double x = game->clip_rect.h / 1080.0;
+		struct TouchArea* area = ev->touch.x < 1920 / 2 * x ? &data->touchpad.stick : &data->touchpad.buttons;
+		area->active = ev->type == ALLEGRO_EVENT_TOUCH_BEGIN || ev->type == ALLEGRO_EVENT_TOUCH_MOVE;
+		area->steering &= area->active;
+		area->x = ev->touch.x;
+		area->y = ev->touch.y;
+		data->input.coalesced += data->touchpad.moved;
+		data->touchpad.moved = true;
 	}
-#else
-	if (ev->type == ALLEGRO_EVENT_JOYSTICK_AXIS && ev->joystick.stick == 2) {
-		data->down = false;
-		data->up = false;
-		if (ev->joystick.pos < -0.25) {
-			data->down = true;
-		} else if (ev->joystick.pos > 0.25) {
-			data->up = true;
-		}
-	}
-	if (ev->type == ALLEGRO_EVENT_JOYSTICK_AXIS && ev->joystick.stick == 3) {
-		data->down = false;
-		if (ev->joystick.pos > 0.25) {
-			data->down = true;
-		}
-	}
-#endif
-
-	double x = game->clip_rect.h / 1080.0;
-	if (ev->type == ALLEGRO_EVENT_TOUCH_BEGIN || ev->type == ALLEGRO_EVENT_TOUCH_MOVE) {
-		int width = al_get_display_width(game->display);
-		int height = al_get_display_height(game->display);
-		if (ev->touch.x < 1920 / 2 * x) {
-			if (((ev->type == ALLEGRO_EVENT_TOUCH_MOVE) && (data->w || data->a || data->s || data->d)) || ((ev->touch.x < 340 * x) && (ev->touch.y > height - 340 * x))) {
-				double cx = ev->touch.x - 170 * x, cy = ev->touch.y - (height - 170 * x);
-				double angle = atan2(cy, cx);
-
-				if ((angle > -ALLEGRO_PI / 4.0 - 0.333) && (angle < ALLEGRO_PI / 4.0 + 0.333)) {
-					data->d = true;
-				} else {
-					data->d = false;
-				}
 
-				if ((angle > ALLEGRO_PI / 4.0 - 0.333) && (angle < 3 * ALLEGRO_PI / 4.0 + 0.333)) {
-					data->s = true;
-				} else {
-					data->s = false;
-				}
-
-				if ((angle > 3 * ALLEGRO_PI / 4.0 - 0.333) || (angle < -3 * ALLEGRO_PI / 4.0 + 0.333)) {
-					data->a = true;
-				} else {
-					data->a = false;
-				}
-
-				if ((angle > -3 * ALLEGRO_PI / 4.0 - 0.333) && (angle < -ALLEGRO_PI / 4.0 + 0.333)) {
-					data->w = true;
-				} else {
-					data->w = false;
-				}
-
-			} else {
-				data->w = false;
-				data->a = false;
-				data->s = false;
-				data->d = false;
-			}
-		} else {
-			if ((ev->touch.x > width - 190 * x) && (ev->touch.y < 420 * x)) {
-				if (ev->touch.y < 190 * x) {
-					data->up = true;
-					data->down = false;
-				} else {
-					data->up = false;
-					data->down = true;
-				}
-			} else {
-				data->up = false;
-				data->down = false;
-			}
-		}
+	if (data->inputlock) {
+		return;
 	}
 
-	if (ev->type == ALLEGRO_EVENT_TOUCH_END || ev->type == ALLEGRO_EVENT_TOUCH_CANCEL) {
-		if (ev->touch.x < 1920 / 2 * x) {
-			data->w = false;
-			data->a = false;
-			data->s = false;
-			data->d = false;
-		} else {
-			data->up = false;
-			data->down = false;
-		}
+	if ((pressed & INPUT_BIT(INPUT_RESTART)) && data->shown) {
+		Restart(game, data);
 	}
 
-	if (data->growlock) {
-		if (data->up || data->down || ev->type == ALLEGRO_EVENT_TOUCH_BEGIN) {
-			data->triedtomove = true;
-		}
-		data->up = false;
-		data->down = false;
-	}
-	if (data->up) {
-		data->upped = true;
-	}
-	if (data->down) {
-		data->downed = true;
-	}
-	if (data->pivotlock) {
-		if (data->w || data->a || data->s || data->d) {
-			data->triedtomove = true;
-		}
-		data->w = false;
-		data->a = false;
-		data->s = false;
-		data->d = false;
-	}
-	if (data->w || data->a || data->s || data->d) {
-		data->pivoted = true;
+	if (data->growlock && ev->type == ALLEGRO_EVENT_TOUCH_BEGIN && !data->triedtomove) {
+		data->triedtomove = true;
+		SignalScripts(game, &data->triedtomove);
 	}
 }
 
@@ -954,15 +749,36 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 
 	struct GamestateResources* data = calloc(1, sizeof(struct GamestateResources));
 
-	data->timeline = TM_Init(game, data, "bob");
+	// the narration comes from the data, so it can be changed without rebuilding
+	const struct ScriptFlag flags[] = {
+		{"inputlock", &data->inputlock},
+		{"growlock", &data->growlock},
+		{"pivotlock", &data->pivotlock},
+		{"shown", &data->shown},
+		{"triedtomove", &data->triedtomove},
+		{"upped", &data->upped},
+		{"downed", &data->downed},
+		{"pivoted", &data->pivoted},
+		{"speaking", &game->data->speaking},
+	};
+	data->narration.voice = ScriptVoice;
+	data->narration.data = data;
+	CompileScript(game, &data->narration, "narration.txt", flags, sizeof(flags) / sizeof(flags[0]));
+	data->late_latch = strtol(GetConfigOptionDefault(game, "Bob", "late_latch", "0"), NULL, 10);
+	data->start_label = FindScriptLabel(&data->narration, "start");
+
+	// voice lines get streamed from the disk when needed, so only a few of them are kept open at once
+	data->prefetch = CreateAudioPrefetch(game);
 
 	progress(game); // report that we progressed with the loading, so the engine can move a progress bar
 
-	for (int i = 0; i < 17; i++) {
-		data->voices[i].sample = al_load_sample(GetDataFilePath(game, FILES[i]));
-		data->voices[i].instance = al_create_sample_instance(data->voices[i].sample);
-		al_attach_sample_instance_to_mixer(data->voices[i].instance, game->audio.voice);
-		progress(game);
+	// the first line is usually preloaded during the intro
+	ALLEGRO_AUDIO_STREAM* first;
+	LoadGamestateResources(game, "game", (void**)&first, progress);
+	if (first) {
+		al_set_audio_stream_playing(first, false);
+		al_set_audio_stream_playmode(first, ALLEGRO_PLAYMODE_ONCE);
+		AdoptAudioStream(data->prefetch, FILES[NextFabVoice(-1)], first);
 	}
 
 	return data;
@@ -971,11 +787,8 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 void Gamestate_Unload(struct Game* game, struct GamestateResources* data) {
 	// Called when the gamestate library is being unloaded.
 	// Good place for freeing all allocated memory and resources.
-	for (int i = 0; i < 17; i++) {
-		al_destroy_sample_instance(data->voices[i].instance);
-		al_destroy_sample(data->voices[i].sample);
-	}
-	TM_Destroy(data->timeline);
+	StopVoice(game, data);
+	DestroyAudioPrefetch(game, data->prefetch);
 	free(data);
 }
 
@@ -983,7 +796,15 @@ void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
 	// Called when this gamestate gets control. Good place for initializing state,
 	// playing music etc.
 	al_set_audio_stream_playing(game->data->music, true);
+	game->data->overlay.draw = DrawExit;
+	game->data->overlay.data = data;
+	if (IsCapturing()) {
+		char source[1024];
+		GetDataFileSource(game, "music.flac", source, sizeof(source));
+		RecordAudioEvent(game, "music play %s", source);
+	}
 	data->current_voice = -1;
+	data->subtitle.voice = -1;
 	data->fab_voice = -1;
 	data->growlock = true;
 	data->pivotlock = true;
@@ -1002,33 +823,17 @@ void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
 	data->d = false;
 	data->up = false;
 	data->down = false;
+	data->input = (struct InputState){0};
+	data->latency.since = 0;
+	data->latency.ticked = data->latency.drawn = 0;
+	data->touchpad.stick = data->touchpad.buttons = (struct TouchArea){0};
+	data->touchpad.moved = true;
 	data->isthisit_triggered = false;
+	PredictVoices(game, data);
 
-	TM_CleanQueue(data->timeline);
-	TM_AddDelay(data->timeline, 1);
-	TM_AddAction(data->timeline, PlayNextVoice, NULL);
-	TM_AddAction(data->timeline, WaitForVoice, NULL);
-	TM_AddAction(data->timeline, UnlockInput, NULL);
-	TM_AddAction(data->timeline, WaitForTryMove, NULL);
-	TM_AddAction(data->timeline, PlayNextVoice, NULL);
-	TM_AddAction(data->timeline, WaitForVoice, NULL);
-	TM_AddAction(data->timeline, UnlockGrow, NULL);
-	TM_AddAction(data->timeline, WaitForUpped, NULL);
-	TM_AddAction(data->timeline, PlayNextVoice, NULL);
-	TM_AddAction(data->timeline, WaitForVoice, NULL);
-	TM_AddAction(data->timeline, WaitForDowned, NULL);
-	TM_AddAction(data->timeline, PlayNextVoice, NULL);
-	TM_AddAction(data->timeline, WaitForVoice, NULL);
-	TM_AddAction(data->timeline, UnlockPivot, NULL);
-	TM_AddAction(data->timeline, WaitForPivoted, NULL);
-	TM_AddAction(data->timeline, PlayNextVoice, NULL);
-	TM_AddAction(data->timeline, WaitForVoice, NULL);
-	TM_AddAction(data->timeline, ShowStuff, NULL);
-	TM_AddAction(data->timeline, PlayNextVoice, NULL);
-	TM_AddAction(data->timeline, WaitForVoice, NULL);
-	TM_AddDelay(data->timeline, 3);
-	TM_AddAction(data->timeline, PlayNextVoice, NULL);
-	TM_AddAction(data->timeline, WaitForVoice, NULL);
+	RegisterScript(game, &data->narration);
+	ResetScript(game, &data->narration);
+	QueueScript(&data->narration, data->start_label);
 
 	StartLevel(game, data, 0);
 }
@@ -1036,7 +841,12 @@ void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
 void Gamestate_Stop(struct Game* game, struct GamestateResources* data) {
 	// Called when gamestate gets stopped. Stop timers, music etc. here.
 	DestroyPhysics(game, data);
+	UnregisterScript(game, &data->narration);
 	game->data->hud.enabled = false;
+	game->data->overlay.draw = NULL;
+	if (game->config.debug.enabled) {
+		PrintConsole(game, "Input: %d events, %d of them coalesced into the next tick", data->input.events, data->input.coalesced);
+	}
 }
 
 // Optional endpoints:
@@ -1044,6 +854,14 @@ void Gamestate_Stop(struct Game* game, struct GamestateResources* data) {
 void Gamestate_PostLoad(struct Game* game, struct GamestateResources* data) {
 	// This is called in the main thread after Gamestate_Load has ended.
 	// Use it to prerender bitmaps, create VBOs, etc.
+	const char* texts[sizeof(LABELS) / sizeof(LABELS[0][0]) + 1] = {NULL};
+	int count = 0;
+	for (size_t i = 0; i < sizeof(LABELS) / sizeof(LABELS[0]); i++) {
+		for (int j = 0; LABELS[i][j]; j++) {
+			texts[count++] = LABELS[i][j];
+		}
+	}
+	WarmupGlyphs(game, game->data->font, "subtitles", texts);
 }
 
 void Gamestate_Pause(struct Game* game, struct GamestateResources* data) {
@@ -27,27 +27,33 @@ struct GamestateResources {
 	float counter;
 };
 
-int Gamestate_ProgressCount = 1;
+int Gamestate_ProgressCount = 2;
+
+static const char* CAPTIONS[] = {"You have reached enlightenment.", "Press a button to play again.", NULL};
 
 void Gamestate_Logic(struct Game* game, struct GamestateResources* data, double delta) {
-	data->counter += delta;
+	data->counter += GetLogicDelta(delta);
 }
 
 void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
+	int signature[] = {0, data->counter > 4.0, data->counter > 6.0};
 	ClearToColor(game, al_map_rgb(255, 255, 255));
 	if (data->counter > 1.0) {
 		float val = (data->counter - 1.0) / 2.0;
 		if (val > 1.0) {
 			val = 1.0;
 		}
+		signature[0] = val * 255;
 		al_draw_tinted_bitmap(data->shod, al_map_rgba_f(val, val, val, val), 1920 / 2.0 - al_get_bitmap_width(data->shod) / 2.0, 1080 - 700, 0);
 	}
 	if (data->counter > 4.0) {
-		al_draw_text(game->data->font, al_map_rgb(0, 0, 0), 1920 / 2.0, 1080 - 280, ALLEGRO_ALIGN_CENTER, "You have reached enlightenment.");
+		DrawCachedText(game, CacheText(game, game->data->font, CAPTIONS[0], 0, 0, ALLEGRO_ALIGN_CENTER), al_map_rgb(0, 0, 0), 1920 / 2.0, 1080 - 280);
 	}
 	if (data->counter > 6.0) {
-		al_draw_text(game->data->font, al_map_rgb(0, 0, 0), 1920 / 2.0, 1080 - 200, ALLEGRO_ALIGN_CENTER, "Press a button to play again.");
+		DrawCachedText(game, CacheText(game, game->data->font, CAPTIONS[1], 0, 0, ALLEGRO_ALIGN_CENTER), al_map_rgb(0, 0, 0), 1920 / 2.0, 1080 - 200);
 	}
+	AddFrameSignature(game, signature, sizeof(signature));
+	SubmitFrameSignature(game);
 }
 
 void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data, ALLEGRO_EVENT* ev) {
@@ -60,26 +66,32 @@ void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data,
 
 void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 	struct GamestateResources* data = calloc(1, sizeof(struct GamestateResources));
-	data->stream = al_load_audio_stream(GetDataFilePath(game, "heaven.flac"), 4, 2048);
+	// usually preloaded while the last level is played
+	void* resources[2];
+	LoadGamestateResources(game, "heaven", resources, progress);
+	data->stream = resources[0];
+	data->shod = resources[1];
+
 	al_set_audio_stream_playing(data->stream, false);
 	al_set_audio_stream_playmode(data->stream, ALLEGRO_PLAYMODE_ONCE);
 	al_attach_audio_stream_to_mixer(data->stream, game->audio.fx);
 
-	data->shod = al_load_bitmap(GetDataFilePath(game, "shod.png"));
-
-	progress(game); // report that we progressed with the loading, so the engine can move a progress bar
-
 	return data;
 }
 
+void Gamestate_PostLoad(struct Game* game, struct GamestateResources* data) {
+	WarmupGlyphs(game, game->data->font, "heaven", CAPTIONS);
+}
+
 void Gamestate_Unload(struct Game* game, struct GamestateResources* data) {
-	al_destroy_audio_stream(data->stream);
-	al_destroy_bitmap(data->shod);
+	DestroyTrackedAudioStream(game, data->stream);
+	DestroyTrackedBitmap(game, MEMORY_BITMAPS, data->shod);
 	free(data);
 }
 
 void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
 	al_set_audio_stream_playing(data->stream, true);
+	RecordSound(game, "heaven", "fx", "heaven.flac");
 	game->data->chime = 0;
 	game->data->val = 0;
 }
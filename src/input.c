@@ -0,0 +1,213 @@
+/*! \file input.c
+ *  \brief Keys, buttons and axes mapped to actions through a table loaded from the config.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <libsuperderpy.h>
+#include <stdio.h>
+
+// Every action in the [Input] config section is a list of what triggers it:
+//   key:<name>           - Allegro's key name, e.g. key:W or key:FULLSTOP
+//   button:<n>           - joystick button
+//   axis:<stick>.<axis><<value> - held while the axis is below the value, or above it with >
+// The defaults below cover the controllers the game has been tested with on each platform.
+
+#if defined(__SWITCH__)
+#define BUTTONS_UP " button:8"
+#define BUTTONS_DOWN " button:9"
+#define BUTTONS_W " button:13"
+#define BUTTONS_A " button:12"
+#define BUTTONS_S " button:15"
+#define BUTTONS_D " button:14"
+#define BUTTONS_SKIP " button:11"
+#elif defined(ALLEGRO_MACOSX)
+#define BUTTONS_UP ""
+#define BUTTONS_DOWN ""
+#define BUTTONS_W " button:11"
+#define BUTTONS_A " button:13"
+#define BUTTONS_S " button:12"
+#define BUTTONS_D " button:14"
+#define BUTTONS_SKIP " button:9"
+#elif defined(ALLEGRO_WINDOWS)
+#define BUTTONS_UP ""
+#define BUTTONS_DOWN ""
+#define BUTTONS_W " button:13"
+#define BUTTONS_A " button:11"
+#define BUTTONS_S " button:12"
+#define BUTTONS_D " button:10"
+#define BUTTONS_SKIP " button:8"
+#else
+#define BUTTONS_UP ""
+#define BUTTONS_DOWN ""
+#define BUTTONS_W ""
+#define BUTTONS_A ""
+#define BUTTONS_S ""
+#define BUTTONS_D ""
+#define BUTTONS_SKIP " button:6"
+#endif
+
+#ifdef ALLEGRO_WINDOWS
+// both triggers share one axis there
+#define TRIGGERS_UP " axis:2.0>0.25"
+#define TRIGGERS_DOWN " axis:2.0<-0.25 axis:3.0>0.25"
+#else
+// triggers rest at -1
+#define TRIGGERS_UP " axis:2.0>-1"
+#define TRIGGERS_DOWN " axis:2.1>-1"
+#endif
+
+static const char* ACTIONS[INPUT_ACTIONS] = {
+	[INPUT_UP] = "up",
+	[INPUT_DOWN] = "down",
+	[INPUT_W] = "w",
+	[INPUT_A] = "a",
+	[INPUT_S] = "s",
+	[INPUT_D] = "d",
+	[INPUT_SKIP] = "skip",
+	[INPUT_RESTART] = "restart",
+	[INPUT_QUIT] = "quit",
+	[INPUT_WIN] = "win",
+};
+
+static const char* DEFAULTS[INPUT_ACTIONS] = {
+	[INPUT_UP] = "key:UP axis:1.1<-0.25" BUTTONS_UP TRIGGERS_UP,
+	[INPUT_DOWN] = "key:DOWN axis:1.1>0.25" BUTTONS_DOWN TRIGGERS_DOWN,
+	[INPUT_W] = "key:W axis:0.1<-0.25" BUTTONS_W,
+	[INPUT_A] = "key:A axis:0.0<-0.25" BUTTONS_A,
+	[INPUT_S] = "key:S axis:0.1>0.25" BUTTONS_S,
+	[INPUT_D] = "key:D axis:0.0>0.25" BUTTONS_D,
+	[INPUT_SKIP] = "key:FULLSTOP" BUTTONS_SKIP,
+	[INPUT_RESTART] = "key:BACKSPACE button:1",
+	[INPUT_QUIT] = "key:ESCAPE",
+	[INPUT_WIN] = "key:ENTER",
+};
+
+static bool ParseBinding(struct InputBindings* bindings, const char* token, uint16_t bit) {
+	int stick, axis, button;
+	char op;
+	float value;
+	if (strncmp(token, "key:", 4) == 0) {
+		for (int key = 1; key < ALLEGRO_KEY_MAX; key++) {
+			if (strcmp(al_keycode_to_name(key), token + 4) == 0) {
+				bindings->keys[key] |= bit;
+				return true;
+			}
+		}
+	} else if (sscanf(token, "button:%d", &button) == 1 && button >= 0 && button < INPUT_MAX_BUTTONS) {
+		bindings->buttons[button] |= bit;
+		return true;
+	} else if (sscanf(token, "axis:%d.%d%c%f", &stick, &axis, &op, &value) == 4 && stick >= 0 && stick < INPUT_MAX_STICKS && axis >= 0 && axis < INPUT_MAX_AXES && (op == '<' || op == '>')) {
+		if (op == '<') {
+			bindings->axes[stick][axis].below |= bit;
+			bindings->axes[stick][axis].low = value;
+		} else {
+			bindings->axes[stick][axis].above |= bit;
+			bindings->axes[stick][axis].high = value;
+		}
+		return true;
+	}
+	return false;
+}
+
+void LoadInputBindings(struct Game* game, struct InputBindings* bindings) {
+	memset(bindings, 0, sizeof(struct InputBindings));
+	for (int i = 0; i < INPUT_ACTIONS; i++) {
+		char list[256];
+		snprintf(list, sizeof(list), "%s", GetConfigOptionDefault(game, "Input", ACTIONS[i], DEFAULTS[i]));
+		for (char* token = strtok(list, " "); token; token = strtok(NULL, " ")) {
+			if (!ParseBinding(bindings, token, INPUT_BIT(i))) {
+				PrintConsole(game, "Input: can't bind %s to %s", token, ACTIONS[i]);
+			}
+		}
+	}
+}
+
+uint16_t ProcessInputEvent(struct Game* game, struct InputState* input, ALLEGRO_EVENT* ev) {
+	// Returns the actions that this event has just pressed. Axes only get stored here and are
+	// turned into actions by UpdateInput, so a burst of them costs one evaluation per tick.
+	struct InputBindings* bindings = &game->data->input;
+	uint16_t pressed = 0;
+	input->events++;
+	switch (ev->type) {
+		case ALLEGRO_EVENT_KEY_DOWN:
+			if (ev->keyboard.keycode < ALLEGRO_KEY_MAX) {
+				pressed = bindings->keys[ev->keyboard.keycode];
+				input->keys |= pressed;
+			}
+			break;
+		case ALLEGRO_EVENT_KEY_UP:
+			if (ev->keyboard.keycode < ALLEGRO_KEY_MAX) {
+				input->keys &= ~bindings->keys[ev->keyboard.keycode];
+			}
+			break;
+		case ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN:
+			if (game->config.debug.verbose) {
+				PrintConsole(game, "id0 %d button down: %d", al_get_joystick(0) == ev->joystick.id, ev->joystick.button);
+			}
+			if (ev->joystick.button < INPUT_MAX_BUTTONS) {
+				pressed = bindings->buttons[ev->joystick.button];
+				input->buttons |= pressed;
+			}
+			break;
+		case ALLEGRO_EVENT_JOYSTICK_BUTTON_UP:
+			if (ev->joystick.button < INPUT_MAX_BUTTONS) {
+				input->buttons &= ~bindings->buttons[ev->joystick.button];
+			}
+			break;
+		case ALLEGRO_EVENT_JOYSTICK_AXIS:
+			if (game->config.debug.verbose) {
+				PrintConsole(game, "id0 %d stick: %d axis %d pos %f", al_get_joystick(0) == ev->joystick.id, ev->joystick.stick, ev->joystick.axis, ev->joystick.pos);
+			}
+			if (ev->joystick.stick < INPUT_MAX_STICKS && ev->joystick.axis < INPUT_MAX_AXES) {
+				input->axes[ev->joystick.stick][ev->joystick.axis] = ev->joystick.pos;
+				input->seen[ev->joystick.stick][ev->joystick.axis] = true;
+				input->coalesced += input->moved;
+				input->moved = true;
+			}
+			break;
+		default:
+			break;
+	}
+	return pressed;
+}
+
+uint16_t UpdateInput(struct Game* game, struct InputState* input) {
+	// once per tick; returns all the actions held right now
+	if (input->moved) {
+		struct InputBindings* bindings = &game->data->input;
+		input->axis_actions = 0;
+		for (int stick = 0; stick < INPUT_MAX_STICKS; stick++) {
+			for (int axis = 0; axis < INPUT_MAX_AXES; axis++) {
+				float pos = input->axes[stick][axis];
+				if (!input->seen[stick][axis]) {
+					// not every axis rests at 0, so they don't count until they've moved
+					continue;
+				}
+				if (bindings->axes[stick][axis].below && pos < bindings->axes[stick][axis].low) {
+					input->axis_actions |= bindings->axes[stick][axis].below;
+				}
+				if (bindings->axes[stick][axis].above && pos > bindings->axes[stick][axis].high) {
+					input->axis_actions |= bindings->axes[stick][axis].above;
+				}
+			}
+		}
+		input->moved = false;
+	}
+	return input->keys | input->buttons | input->axis_actions;
+}
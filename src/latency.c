@@ -0,0 +1,72 @@
+/*! \file latency.c
+ *  \brief Time from input events to the frames that first show their effect.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <libsuperderpy.h>
+#include <stdio.h>
+
+#define LATENCY_REPORT_EVERY 64 // samples, in debug mode
+
+// Gamestates decide which event made a visible difference and call MarkInputShown from their Draw.
+// The sample is taken once the compositor has submitted the frame, right before the engine flips it,
+// so what's measured is everything up to the display's own latency.
+
+void MarkInputShown(struct Game* game, double timestamp) {
+	// the oldest event wins when several show up in one frame
+	if (!game->data->latency.pending || timestamp < game->data->latency.pending) {
+		game->data->latency.pending = timestamp;
+	}
+}
+
+void FinishLatencyFrame(struct Game* game) {
+	struct CommonResources* data = game->data;
+	if (!data->latency.pending) {
+		return;
+	}
+	data->latency.samples[data->latency.count++ % LATENCY_SAMPLES] = al_get_time() - data->latency.pending;
+	data->latency.pending = 0;
+
+	if (game->config.debug.enabled && data->latency.count - data->latency.reported >= LATENCY_REPORT_EVERY) {
+		char text[128];
+		if (DescribeLatency(game, text, sizeof(text))) {
+			PrintConsole(game, "Latency: %s", text);
+		}
+		data->latency.reported = data->latency.count;
+	}
+}
+
+static int CompareFloats(const void* a, const void* b) {
+	float x = *(const float*)a, y = *(const float*)b;
+	return (x > y) - (x < y);
+}
+
+bool DescribeLatency(struct Game* game, char* text, size_t size) {
+	// percentiles over the last LATENCY_SAMPLES events
+	int count = game->data->latency.count < LATENCY_SAMPLES ? game->data->latency.count : LATENCY_SAMPLES;
+	if (!count) {
+		return false;
+	}
+	float sorted[LATENCY_SAMPLES];
+	memcpy(sorted, game->data->latency.samples, sizeof(float) * count);
+	qsort(sorted, count, sizeof(float), CompareFloats);
+	snprintf(text, size, "input to frame p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms over %d events", sorted[count / 2] * 1000,
+		sorted[count * 9 / 10] * 1000, sorted[count * 99 / 100] * 1000, sorted[count - 1] * 1000, count);
+	return true;
+}
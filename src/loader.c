@@ -0,0 +1,143 @@
+/*! \file loader.c
+ *  \brief Decoding independent assets on several threads during loading.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <libsuperderpy.h>
+#include <stdio.h>
+
+#define LOADER_MAX_THREADS 8
+
+struct Loader {
+	struct LoadJob* jobs;
+	int count, next, done;
+	int bitmap_flags, bitmap_format; // new bitmap settings are per thread, so they're passed on to the workers
+	ALLEGRO_MUTEX* mutex;
+	ALLEGRO_COND* cond;
+	ALLEGRO_THREAD* workers[LOADER_MAX_THREADS];
+	int threads;
+	double start;
+};
+
+void* LoadSampleJob(struct LoadJob* job) {
+	ALLEGRO_SAMPLE* sample = al_load_sample_f(job->fp, job->ident);
+	al_fclose(job->fp);
+	return sample;
+}
+
+void* LoadStreamJob(struct LoadJob* job) {
+	// streams and fonts keep reading from the file, so it's theirs now, unless loading fails
+	ALLEGRO_AUDIO_STREAM* stream = al_load_audio_stream_f(job->fp, job->ident, job->buffers, job->size);
+	if (!stream) {
+		al_fclose(job->fp);
+	}
+	return stream;
+}
+
+void* LoadFontJob(struct LoadJob* job) {
+	return al_load_ttf_font_f(job->fp, job->file, job->size, job->flags);
+}
+
+void* LoadBitmapJob(struct LoadJob* job) {
+	// there's no GL context on the workers, so this makes a memory bitmap the engine converts later
+	ALLEGRO_BITMAP* bitmap = al_load_bitmap_f(job->fp, job->ident);
+	al_fclose(job->fp);
+	return bitmap;
+}
+
+static void* LoaderThread(ALLEGRO_THREAD* thread, void* arg) {
+	struct Loader* loader = arg;
+	al_set_new_bitmap_flags(loader->bitmap_flags);
+	al_set_new_bitmap_format(loader->bitmap_format);
+	al_lock_mutex(loader->mutex);
+	while (loader->next < loader->count) {
+		struct LoadJob* job = &loader->jobs[loader->next++];
+		al_unlock_mutex(loader->mutex);
+		job->result = job->fp ? job->load(job) : NULL;
+		al_lock_mutex(loader->mutex);
+		loader->done++;
+		al_broadcast_cond(loader->cond);
+	}
+	al_unlock_mutex(loader->mutex);
+	return NULL;
+}
+
+struct Loader* StartLoadJobs(struct Game* game, struct LoadJob* jobs, int count) {
+	// Jobs must not depend on each other nor need the GL context; bitmaps that are created rather
+	// than loaded stay with the caller, which can do that while the workers are busy.
+	struct Loader* loader = malloc(sizeof(struct Loader));
+	*loader = (struct Loader){.jobs = jobs, .count = count, .bitmap_flags = al_get_new_bitmap_flags(), .bitmap_format = al_get_new_bitmap_format(), .start = al_get_time()};
+	for (int i = 0; i < count; i++) {
+		jobs[i].fp = OpenDataFile(game, jobs[i].file, &jobs[i].ident);
+	}
+	loader->mutex = al_create_mutex();
+	loader->cond = al_create_cond();
+	loader->threads = fmin(fmin(count, LOADER_MAX_THREADS), fmax(1, al_get_cpu_count()));
+	for (int i = 0; i < loader->threads; i++) {
+		loader->workers[i] = al_create_thread(LoaderThread, loader);
+		al_start_thread(loader->workers[i]);
+	}
+	return loader;
+}
+
+bool IsLoadFinished(struct Loader* loader) {
+	al_lock_mutex(loader->mutex);
+	bool finished = loader->done == loader->count;
+	al_unlock_mutex(loader->mutex);
+	return finished;
+}
+
+void FinishLoadJobs(struct Game* game, struct Loader* loader, void (*progress)(struct Game*)) {
+	// Completions are reported through progress from the calling thread, as the engine expects,
+	// so the bar moves as soon as anything is done.
+	int reported = 0;
+	al_lock_mutex(loader->mutex);
+	while (reported < loader->count) {
+		while (loader->done == reported) {
+			al_wait_cond(loader->cond, loader->mutex);
+		}
+		int done = loader->done;
+		al_unlock_mutex(loader->mutex);
+		for (; reported < done; reported++) {
+			if (progress) {
+				progress(game);
+			}
+		}
+		al_lock_mutex(loader->mutex);
+	}
+	al_unlock_mutex(loader->mutex);
+
+	for (int i = 0; i < loader->threads; i++) {
+		al_join_thread(loader->workers[i], NULL);
+		al_destroy_thread(loader->workers[i]);
+	}
+	al_destroy_cond(loader->cond);
+	al_destroy_mutex(loader->mutex);
+
+	for (int i = 0; i < loader->count; i++) {
+		if (!loader->jobs[i].result) {
+			PrintConsole(game, "Loader: couldn't load %s", loader->jobs[i].file);
+		}
+		TrackLoadJob(game, &loader->jobs[i]);
+	}
+	if (game->config.debug.enabled) {
+		PrintConsole(game, "Loader: %d assets in %.1f ms on %d threads", loader->count, (al_get_time() - loader->start) * 1000, loader->threads);
+	}
+	free(loader);
+}
@@ -32,7 +32,21 @@ static _Noreturn void derp(int sig) {
 int main(int argc, char** argv) {
 	signal(SIGSEGV, derp);
 
-	srand(time(NULL));
+	// standalone tools, which are done before the game would even start
+	int tool = RunOscillatorBenchmark(&argc, argv);
+	if (tool < 0) {
+		tool = RunAudioRender(&argc, argv);
+	}
+	if (tool < 0) {
+		tool = RunDataPack(&argc, argv);
+	}
+	if (tool >= 0) {
+		return tool;
+	}
+
+	// a scripted capture has to play out the same way every time
+	bool capture = ParseCaptureArgs(&argc, argv);
+	srand(capture ? 0 : time(NULL));
 
 	al_set_org_name("dosowisko.net");
 	al_set_app_name(LIBSUPERDERPY_GAMENAME_PRETTY);
@@ -45,14 +59,19 @@ int main(int argc, char** argv) {
 				.event = GlobalEventHandler,
 				.destroy = DestroyGameData,
 				.compositor = Compositor,
+				.prelogic = capture ? ProcessCaptureScript : NULL,
+				.postlogic = GlobalPostLogic,
 			},
 		});
 	if (!game) { return 1; }
 
+	OpenDataPack(game);
 	LoadGamestate(game, "dosowisko");
 	StartGamestate(game, "dosowisko");
 
 	game->data = CreateGameData(game);
 
-	return libsuperderpy_run(game);
+	int ret = libsuperderpy_run(game);
+	CloseDataPack();
+	return ret ? ret : GetCaptureExitCode();
 }
@@ -0,0 +1,231 @@
+/*! \file memory.c
+ *  \brief Accounting of what the game keeps in memory, per category and against budgets.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <libsuperderpy.h>
+#include <stdio.h>
+
+// Whatever makes a resource tracks it and whatever destroys it releases it, with sizes worked out
+// from the resource itself, so both sides always agree. Textures count as their pixels, without
+// the driver's own overhead; fonts aren't counted, their glyphs end up in bitmaps Allegro manages.
+
+static const char* MEMORY_NAMES[] = {"targets", "bitmaps", "audio", "physics", "total"};
+
+void InitMemoryTracking(struct Game* game) {
+	struct CommonResources* data = game->data;
+	data->memory.mutex = al_create_mutex();
+	for (int i = 0; i <= MEMORY_TOTAL; i++) {
+		// in MB, from memory_budget_targets etc. and memory_budget for everything together
+		char key[64] = "memory_budget";
+		if (i != MEMORY_TOTAL) {
+			snprintf(key, sizeof(key), "memory_budget_%s", MEMORY_NAMES[i]);
+		}
+		data->memory.budget[i] = strtod(GetConfigOptionDefault(game, "Bob", key, "0"), NULL) * 1048576;
+	}
+}
+
+static void CheckMemoryBudget(struct Game* game, enum MemoryCategory category) {
+	// called with the mutex held, possibly on a loading thread, so it only takes note of it
+	struct CommonResources* data = game->data;
+	if (!data->memory.budget[category]) {
+		return;
+	}
+	bool over = data->memory.current[category] > data->memory.budget[category];
+	if (over && !data->memory.over[category]) {
+		// reported once each time it goes over, not on every allocation made while it stays there
+		data->memory.crossed[category] = data->memory.current[category];
+	}
+	data->memory.over[category] = over;
+}
+
+void TrackMemory(struct Game* game, enum MemoryCategory category, size_t bytes) {
+	struct CommonResources* data = game->data;
+	if (!bytes) {
+		return;
+	}
+	al_lock_mutex(data->memory.mutex);
+	enum MemoryCategory both[] = {category, MEMORY_TOTAL};
+	for (int i = 0; i < 2; i++) {
+		data->memory.current[both[i]] += bytes;
+		if (data->memory.current[both[i]] > data->memory.peak[both[i]]) {
+			data->memory.peak[both[i]] = data->memory.current[both[i]];
+		}
+		CheckMemoryBudget(game, both[i]);
+	}
+	al_unlock_mutex(data->memory.mutex);
+}
+
+void ReleaseMemory(struct Game* game, enum MemoryCategory category, size_t bytes) {
+	struct CommonResources* data = game->data;
+	if (!bytes) {
+		return;
+	}
+	al_lock_mutex(data->memory.mutex);
+	enum MemoryCategory both[] = {category, MEMORY_TOTAL};
+	for (int i = 0; i < 2; i++) {
+		data->memory.current[both[i]] -= bytes > data->memory.current[both[i]] ? data->memory.current[both[i]] : bytes;
+		CheckMemoryBudget(game, both[i]);
+	}
+	al_unlock_mutex(data->memory.mutex);
+}
+
+size_t GetMemoryUsage(struct Game* game, enum MemoryCategory category, size_t* peak) {
+	struct CommonResources* data = game->data;
+	al_lock_mutex(data->memory.mutex);
+	size_t current = data->memory.current[category];
+	if (peak) {
+		*peak = data->memory.peak[category];
+	}
+	al_unlock_mutex(data->memory.mutex);
+	return current;
+}
+
+bool DescribeMemory(struct Game* game, char* text, size_t size) {
+	size_t len = 0;
+	text[0] = 0;
+	for (int i = 0; i <= MEMORY_TOTAL && len < size; i++) {
+		size_t peak, current = GetMemoryUsage(game, i, &peak);
+		len += snprintf(text + len, size - len, "%s%s %.1f MB (peak %.1f)", i ? ", " : "", MEMORY_NAMES[i], current / 1048576.0, peak / 1048576.0);
+	}
+	size_t peak;
+	GetMemoryUsage(game, MEMORY_TOTAL, &peak);
+	return peak > 0;
+}
+
+void ReportMemoryBudgets(struct Game* game) {
+	struct CommonResources* data = game->data;
+	size_t crossed[MEMORY_TOTAL + 1];
+	al_lock_mutex(data->memory.mutex);
+	memcpy(crossed, data->memory.crossed, sizeof(crossed));
+	memset(data->memory.crossed, 0, sizeof(data->memory.crossed));
+	al_unlock_mutex(data->memory.mutex);
+
+	for (int i = 0; i <= MEMORY_TOTAL; i++) {
+		if (!crossed[i]) {
+			continue;
+		}
+		char reason[128];
+		snprintf(reason, sizeof(reason), "%s memory at %.1f MB, over the budget of %.1f MB", MEMORY_NAMES[i],
+			crossed[i] / 1048576.0, data->memory.budget[i] / 1048576.0);
+		PrintConsole(game, "Memory: %s", reason);
+		FailCapture(game, reason);
+	}
+}
+
+void DestroyMemoryTracking(struct Game* game) {
+	char text[256];
+	if (DescribeMemory(game, text, sizeof(text))) {
+		// what's still there is what the engine's own teardown takes care of, or a leak
+		PrintConsole(game, "Memory: %s", text);
+	}
+	al_destroy_mutex(game->data->memory.mutex);
+}
+
+size_t MeasureBitmap(ALLEGRO_BITMAP* bitmap) {
+	if (!bitmap || al_get_parent_bitmap(bitmap)) {
+		// sub-bitmaps share their parent's pixels
+		return 0;
+	}
+	return (size_t)al_get_bitmap_width(bitmap) * al_get_bitmap_height(bitmap) * al_get_pixel_size(al_get_bitmap_format(bitmap));
+}
+
+size_t MeasureSample(ALLEGRO_SAMPLE* sample) {
+	if (!sample) {
+		return 0;
+	}
+	return (size_t)al_get_sample_length(sample) * al_get_channel_count(al_get_sample_channels(sample)) * al_get_audio_depth_size(al_get_sample_depth(sample));
+}
+
+size_t MeasureAudioStream(ALLEGRO_AUDIO_STREAM* stream) {
+	// streams only hold their queue, the rest gets read as it plays
+	if (!stream) {
+		return 0;
+	}
+	return (size_t)al_get_audio_stream_fragments(stream) * al_get_audio_stream_length(stream) *
+		al_get_channel_count(al_get_audio_stream_channels(stream)) * al_get_audio_depth_size(al_get_audio_stream_depth(stream));
+}
+
+ALLEGRO_BITMAP* TrackBitmap(struct Game* game, enum MemoryCategory category, ALLEGRO_BITMAP* bitmap) {
+	TrackMemory(game, category, MeasureBitmap(bitmap));
+	return bitmap;
+}
+
+void DestroyTrackedBitmap(struct Game* game, enum MemoryCategory category, ALLEGRO_BITMAP* bitmap) {
+	if (!bitmap) {
+		return;
+	}
+	ReleaseMemory(game, category, MeasureBitmap(bitmap));
+	al_destroy_bitmap(bitmap);
+}
+
+ALLEGRO_SAMPLE* TrackSample(struct Game* game, ALLEGRO_SAMPLE* sample) {
+	TrackMemory(game, MEMORY_AUDIO, MeasureSample(sample));
+	return sample;
+}
+
+void DestroyTrackedSample(struct Game* game, ALLEGRO_SAMPLE* sample) {
+	if (!sample) {
+		return;
+	}
+	ReleaseMemory(game, MEMORY_AUDIO, MeasureSample(sample));
+	al_destroy_sample(sample);
+}
+
+ALLEGRO_AUDIO_STREAM* TrackAudioStream(struct Game* game, ALLEGRO_AUDIO_STREAM* stream) {
+	TrackMemory(game, MEMORY_AUDIO, MeasureAudioStream(stream));
+	return stream;
+}
+
+void DestroyTrackedAudioStream(struct Game* game, ALLEGRO_AUDIO_STREAM* stream) {
+	if (!stream) {
+		return;
+	}
+	ReleaseMemory(game, MEMORY_AUDIO, MeasureAudioStream(stream));
+	al_destroy_audio_stream(stream);
+}
+
+void TrackLoadJob(struct Game* game, struct LoadJob* job) {
+	if (!job->result) {
+		return;
+	}
+	if (job->load == LoadBitmapJob) {
+		TrackBitmap(game, MEMORY_BITMAPS, job->result);
+	} else if (job->load == LoadSampleJob) {
+		TrackSample(game, job->result);
+	} else if (job->load == LoadStreamJob) {
+		TrackAudioStream(game, job->result);
+	}
+}
+
+void DestroyLoadJobResult(struct Game* game, struct LoadJob* job) {
+	if (!job->result) {
+		return;
+	}
+	if (job->load == LoadBitmapJob) {
+		DestroyTrackedBitmap(game, MEMORY_BITMAPS, job->result);
+	} else if (job->load == LoadSampleJob) {
+		DestroyTrackedSample(game, job->result);
+	} else if (job->load == LoadStreamJob) {
+		DestroyTrackedAudioStream(game, job->result);
+	} else if (job->load == LoadFontJob) {
+		al_destroy_font(job->result);
+	}
+	job->result = NULL;
+}
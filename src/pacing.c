@@ -0,0 +1,194 @@
+/*! \file pacing.c
+ *  \brief Lower frame rates for screens that aren't changing or aren't being looked at.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <libsuperderpy.h>
+#include <math.h>
+
+#define PACING_IDLE_DELAY 1.5 // seconds without input before a settled screen slows down
+#define PACING_REPORT_EVERY 60.0 // seconds
+
+// The engine renders one frame per main loop iteration and logic catches up with whatever time passed,
+// so holding the compositor back is enough to slow the whole thing down. Audio has its own threads
+// and keeps going. The wait happens on a queue that also listens to the input devices and the display,
+// so a key press or getting the focus back ends it right away instead of at the next throttled frame.
+
+void InitFramePacing(struct Game* game) {
+	struct CommonResources* data = game->data;
+	data->pacing.enabled = strtol(GetConfigOptionDefault(game, "Bob", "frame_pacing", "1"), NULL, 10);
+	data->pacing.idle_fps = strtol(GetConfigOptionDefault(game, "Bob", "idle_fps", "15"), NULL, 10);
+	data->pacing.background_fps = strtol(GetConfigOptionDefault(game, "Bob", "background_fps", "5"), NULL, 10);
+	data->pacing.focused = true;
+	data->pacing.activity = al_get_time();
+	data->pacing.done = data->pacing.activity;
+	data->pacing.minute.start = data->pacing.activity;
+	data->pacing.clock = clock();
+	if (IsCapturing()) {
+		// captured frames are stepped by the capture itself
+		data->pacing.enabled = false;
+	}
+	if (!data->pacing.enabled) {
+		return;
+	}
+
+	data->pacing.wake = al_create_event_queue();
+	al_register_event_source(data->pacing.wake, al_get_display_event_source(game->display));
+	if (al_is_keyboard_installed()) {
+		al_register_event_source(data->pacing.wake, al_get_keyboard_event_source());
+	}
+	if (al_is_mouse_installed()) {
+		al_register_event_source(data->pacing.wake, al_get_mouse_event_source());
+	}
+	if (al_is_joystick_installed()) {
+		al_register_event_source(data->pacing.wake, al_get_joystick_event_source());
+	}
+	if (al_is_touch_input_installed()) {
+		al_register_event_source(data->pacing.wake, al_get_touch_input_event_source());
+	}
+}
+
+void NoteFramePacingEvent(struct Game* game, ALLEGRO_EVENT* ev) {
+	struct CommonResources* data = game->data;
+	switch (ev->type) {
+		case ALLEGRO_EVENT_DISPLAY_SWITCH_OUT:
+			data->pacing.focused = false;
+			break;
+		case ALLEGRO_EVENT_DISPLAY_SWITCH_IN:
+			data->pacing.focused = true;
+			data->pacing.activity = al_get_time();
+			break;
+		case ALLEGRO_EVENT_DISPLAY_HALT_DRAWING:
+			// sent on mobile when the app goes to the background, there's no one to draw for until it resumes
+			data->pacing.halted = true;
+			break;
+		case ALLEGRO_EVENT_DISPLAY_RESUME_DRAWING:
+			data->pacing.halted = false;
+			data->pacing.activity = al_get_time();
+			break;
+		case ALLEGRO_EVENT_KEY_DOWN:
+		case ALLEGRO_EVENT_KEY_UP:
+		case ALLEGRO_EVENT_JOYSTICK_AXIS:
+		case ALLEGRO_EVENT_JOYSTICK_BUTTON_DOWN:
+		case ALLEGRO_EVENT_JOYSTICK_BUTTON_UP:
+		case ALLEGRO_EVENT_TOUCH_BEGIN:
+		case ALLEGRO_EVENT_TOUCH_MOVE:
+		case ALLEGRO_EVENT_TOUCH_END:
+		case ALLEGRO_EVENT_MOUSE_AXES:
+		case ALLEGRO_EVENT_MOUSE_BUTTON_DOWN:
+			data->pacing.activity = al_get_time();
+			break;
+		default:
+			break;
+	}
+}
+
+static int ChooseFrameRate(struct Game* game, double now) {
+	struct CommonResources* data = game->data;
+	// there's no event for getting minimized, but where Allegro knows about it the display says so
+	if (!data->pacing.focused || data->pacing.halted || (al_get_display_flags(game->display) & ALLEGRO_MINIMIZED)) {
+		return data->pacing.background_fps;
+	}
+	if (data->frame.static_frames >= STATIC_SETTLE_FRAMES && now - data->pacing.activity >= PACING_IDLE_DELAY) {
+		return data->pacing.idle_fps;
+	}
+	return 0;
+}
+
+static void ReportFramePacing(struct Game* game, double now) {
+	struct CommonResources* data = game->data;
+	if (data->pacing.minute.frames && data->pacing.full.interval > 0) {
+		// what the throttled stretches would have cost at the full rate, compared to what they did cost;
+		// there are no GPU timer queries here, so the time spent submitting the frame stands in for the GPU's work
+		double expected = data->pacing.minute.span / data->pacing.full.interval;
+		double skipped = fmax(expected - data->pacing.minute.frames, 0);
+		double cpu = fmax(expected * data->pacing.full.cpu - data->pacing.minute.cpu, 0);
+		PrintConsole(game, "Frame pacing: throttled for %.1f s of the last %.0f s, %.0f frames skipped, saved %.2f s of CPU time and %.2f s of rendering",
+			data->pacing.minute.span, now - data->pacing.minute.start, skipped, cpu, skipped * data->pacing.full.render);
+	}
+	data->pacing.minute.start = now;
+	data->pacing.minute.span = 0;
+	data->pacing.minute.cpu = 0;
+	data->pacing.minute.frames = 0;
+}
+
+void PaceFrame(struct Game* game, double start) {
+	struct CommonResources* data = game->data;
+	if (!data->pacing.enabled) {
+		return;
+	}
+	double now = al_get_time();
+	clock_t clk = clock();
+	double interval = now - data->pacing.done;
+	double cpu = (double)(clk - data->pacing.clock) / CLOCKS_PER_SEC;
+
+	if (!data->pacing.rate) {
+		if (interval < 0.25) {
+			// hiccups aren't what full speed costs
+			data->pacing.full.interval = data->pacing.full.interval ? data->pacing.full.interval * 0.9 + interval * 0.1 : interval;
+			data->pacing.full.cpu = data->pacing.full.cpu ? data->pacing.full.cpu * 0.9 + cpu * 0.1 : cpu;
+			data->pacing.full.render = data->pacing.full.render ? data->pacing.full.render * 0.9 + (now - start) * 0.1 : now - start;
+		}
+	} else {
+		data->pacing.minute.span += interval;
+		data->pacing.minute.cpu += cpu;
+		data->pacing.minute.frames++;
+	}
+
+	int rate = ChooseFrameRate(game, now);
+	if (rate != data->pacing.rate && game->config.debug.enabled) {
+		PrintConsole(game, "Frame pacing: %s", rate ? (data->pacing.focused ? "idle" : "in background") : "full rate");
+	}
+	if (rate && !data->pacing.rate) {
+		data->pacing.next = now;
+	}
+	data->pacing.rate = rate;
+
+	if (rate > 0) {
+		double period = 1.0 / rate;
+		// keep to the schedule, but don't try to make up for frames that were late
+		data->pacing.next = fmax(data->pacing.next + period, now);
+		double wait = data->pacing.next - now;
+		ALLEGRO_EVENT ev;
+		if (wait > 0 && al_wait_for_event_timed(data->pacing.wake, &ev, wait)) {
+			// whatever woke us up is on the engine's queue as well and gets handled there
+			data->pacing.activity = al_get_time();
+		}
+		al_flush_event_queue(data->pacing.wake);
+		double slept = al_get_time() - now;
+		// dynamic resolution is after the cost of the frames, not of the waits in between
+		data->dynres.last += slept;
+	} else {
+		al_flush_event_queue(data->pacing.wake);
+	}
+
+	// the wait is counted towards the next frame, so throttled frames get measured along with their share of it
+	data->pacing.done = now;
+	data->pacing.clock = clk;
+	if (now - data->pacing.minute.start >= PACING_REPORT_EVERY) {
+		ReportFramePacing(game, now);
+	}
+}
+
+void DestroyFramePacing(struct Game* game) {
+	struct CommonResources* data = game->data;
+	if (data->pacing.wake) {
+		al_destroy_event_queue(data->pacing.wake);
+	}
+}
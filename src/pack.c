@@ -0,0 +1,486 @@
+/*! \file pack.c
+ *  \brief Game data packed into a single memory-mapped archive, with audio decoded ahead of time.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <libsuperderpy.h>
+#include <stdio.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define PACK_FILENAME "data.pak"
+#define PACK_MAGIC "BOBPACK1"
+#define PACK_NAME_LENGTH 112
+#define PACK_ALIGNMENT 16
+#define PACK_DEFAULT_RATE 44100 // what the engine's mixers run at
+
+// Layout: header, then a table of entries sorted by name, then the data of each entry aligned to
+// PACK_ALIGNMENT. Audio gets stored as 16-bit WAV already at the mixer's rate, so loading it is a copy
+// instead of decoding and resampling. Everything else is stored as it was.
+
+struct PackHeader {
+	char magic[8];
+	uint32_t count;
+	uint32_t rate;
+};
+
+struct PackEntry {
+	char name[PACK_NAME_LENGTH]; // relative to the data directory, with forward slashes
+	uint64_t offset, size;
+	uint32_t audio;
+	uint32_t reserved;
+};
+
+// Opened before the first gamestate gets loaded, which happens before there's any CommonResources.
+static struct {
+	unsigned char* data;
+	size_t size;
+	bool mapped;
+	const struct PackEntry* entries;
+	uint32_t count;
+	char path[1024];
+
+	atomic_int packed, loose;
+	double start;
+	long long syscalls, bytes;
+	bool reported;
+} pack;
+
+static bool ReadProcessIO(long long* syscalls, long long* bytes) {
+	// read syscalls and bytes done by the process so far; only Linux has those
+	FILE* file = fopen("/proc/self/io", "r");
+	if (!file) {
+		return false;
+	}
+	char line[128];
+	while (fgets(line, sizeof(line), file)) {
+		sscanf(line, "syscr: %lld", syscalls);
+		sscanf(line, "rchar: %lld", bytes);
+	}
+	fclose(file);
+	return true;
+}
+
+static bool MapPack(const char* path) {
+#ifndef _WIN32
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	pack.mapped = true;
+#else
+	// no mmap there, so it's read in one go instead
+	ALLEGRO_FILE* file = al_fopen(path, "rb");
+	if (!file) {
+		return false;
+	}
+	struct {
+		int64_t st_size;
+	} st = {al_fsize(file)};
+	void* data = malloc(st.st_size);
+	al_fread(file, data, st.st_size);
+	al_fclose(file);
+#endif
+	pack.data = data;
+	pack.size = st.st_size;
+	snprintf(pack.path, sizeof(pack.path), "%s", path);
+	return true;
+}
+
+static const char* ValidatePack(void) {
+	// returns what's wrong with the mapped pack, NULL when it's fine to use
+	const struct PackHeader* header = (const struct PackHeader*)pack.data;
+	if (pack.size < sizeof(struct PackHeader) || memcmp(header->magic, PACK_MAGIC, sizeof(header->magic)) != 0 ||
+		pack.size < sizeof(struct PackHeader) + header->count * sizeof(struct PackEntry)) {
+		return "invalid";
+	}
+	const struct PackEntry* entries = (const struct PackEntry*)(pack.data + sizeof(struct PackHeader));
+	for (uint32_t i = 0; i < header->count; i++) {
+		if (entries[i].offset + entries[i].size > pack.size) {
+			return "truncated";
+		}
+	}
+	pack.entries = entries;
+	pack.count = header->count;
+	return NULL;
+}
+
+void CloseDataPack(void) {
+	if (!pack.data) {
+		return;
+	}
+#ifndef _WIN32
+	munmap(pack.data, pack.size);
+#else
+	free(pack.data);
+#endif
+	pack.data = NULL;
+	pack.entries = NULL;
+	pack.count = 0;
+}
+
+void OpenDataPack(struct Game* game) {
+	pack.start = al_get_time();
+	ReadProcessIO(&pack.syscalls, &pack.bytes);
+	if (!strtol(GetConfigOptionDefault(game, "Bob", "data_pack", "1"), NULL, 10)) {
+		PrintConsole(game, "Data: using loose files, the data pack is disabled");
+		return;
+	}
+
+	ALLEGRO_PATH* path = al_get_standard_path(ALLEGRO_RESOURCES_PATH);
+	al_set_path_filename(path, PACK_FILENAME);
+	bool found = MapPack(al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP)) || MapPack(PACK_FILENAME);
+	al_destroy_path(path);
+	if (!found) {
+		PrintConsole(game, "Data: no %s found, using loose files", PACK_FILENAME);
+		return;
+	}
+
+	const char* problem = ValidatePack();
+	if (problem) {
+		PrintConsole(game, "Data: %s is %s, using loose files", PACK_FILENAME, problem);
+		CloseDataPack();
+		return;
+	}
+	const struct PackHeader* header = (const struct PackHeader*)pack.data;
+	PrintConsole(game, "Data: %u files in %s (%.1f MB, audio at %u Hz)%s", pack.count, PACK_FILENAME, pack.size / 1048576.0, header->rate, pack.mapped ? ", memory-mapped" : "");
+	unsigned int frequency = al_get_mixer_frequency(game->audio.music);
+	if (header->rate != frequency) {
+		// still plays fine, but the mixer resamples it on the audio thread, which the pack was meant to spare
+		PrintConsole(game, "Data: %s has audio at %u Hz, but the mixer runs at %u Hz; rebuild it with --pack-rate %u", PACK_FILENAME, header->rate, frequency, frequency);
+	}
+}
+
+static int CompareEntry(const void* name, const void* entry) {
+	return strcmp(name, ((const struct PackEntry*)entry)->name);
+}
+
+static const struct PackEntry* FindPackEntry(const char* name) {
+	return pack.count ? bsearch(name, pack.entries, pack.count, sizeof(struct PackEntry), CompareEntry) : NULL;
+}
+
+const char* GetDataPackPath(void) {
+	return pack.count ? pack.path : NULL;
+}
+
+void GetDataFileSource(struct Game* game, const char* name, char* source, size_t size) {
+	// where a file really comes from, for tools replaying what the game did without a Game of their own
+	if (FindPackEntry(name)) {
+		snprintf(source, size, "pack:%s", name);
+	} else {
+		snprintf(source, size, "%s", GetDataFilePath(game, name));
+	}
+}
+
+bool OpenDataPackAt(const char* path) {
+	if (!MapPack(path)) {
+		return false;
+	}
+	if (ValidatePack()) {
+		CloseDataPack();
+		return false;
+	}
+	return true;
+}
+
+ALLEGRO_SAMPLE* LoadSourceSample(const char* source) {
+	// the counterpart of GetDataFileSource; packed sources need the pack opened with OpenDataPackAt
+	if (strncmp(source, "pack:", 5) != 0) {
+		return al_load_sample(source);
+	}
+	const struct PackEntry* entry = FindPackEntry(source + 5);
+	if (!entry) {
+		return NULL;
+	}
+	ALLEGRO_FILE* file = al_open_memfile(pack.data + entry->offset, entry->size, "r");
+	ALLEGRO_SAMPLE* sample = al_load_sample_f(file, entry->audio ? ".wav" : strrchr(source, '.'));
+	al_fclose(file);
+	return sample;
+}
+
+ALLEGRO_FILE* OpenDataFile(struct Game* game, const char* name, const char** ident) {
+	// ident is what Allegro needs to pick the right loader, as the name of a packed file may lie about its format
+	const struct PackEntry* entry = FindPackEntry(name);
+	if (entry) {
+		atomic_fetch_add(&pack.packed, 1);
+		*ident = entry->audio ? ".wav" : strrchr(name, '.');
+		// no copy; the memory stays mapped until the game quits
+		return al_open_memfile(pack.data + entry->offset, entry->size, "r");
+	}
+	atomic_fetch_add(&pack.loose, 1);
+	*ident = strrchr(name, '.');
+	return al_fopen(GetDataFilePath(game, name), "rb");
+}
+
+ALLEGRO_BITMAP* LoadDataBitmap(struct Game* game, const char* name) {
+	const char* ident;
+	ALLEGRO_FILE* file = OpenDataFile(game, name, &ident);
+	if (!file) {
+		return NULL;
+	}
+	ALLEGRO_BITMAP* bitmap = al_load_bitmap_f(file, ident);
+	al_fclose(file);
+	return bitmap;
+}
+
+ALLEGRO_FONT* LoadDataFont(struct Game* game, const char* name, int size, int flags) {
+	// the font reads glyphs from the file as they're needed, so it keeps it
+	const char* ident;
+	ALLEGRO_FILE* file = OpenDataFile(game, name, &ident);
+	return file ? al_load_ttf_font_f(file, name, size, flags) : NULL;
+}
+
+ALLEGRO_AUDIO_STREAM* LoadDataStream(struct Game* game, const char* name, size_t buffers, unsigned int samples) {
+	const char* ident;
+	ALLEGRO_FILE* file = OpenDataFile(game, name, &ident);
+	if (!file) {
+		return NULL;
+	}
+	ALLEGRO_AUDIO_STREAM* stream = al_load_audio_stream_f(file, ident, buffers, samples);
+	if (!stream) {
+		al_fclose(file);
+	}
+	return stream;
+}
+
+void ReportDataLoading(struct Game* game, const char* milestone) {
+	// Comparing against the loose files is a matter of running again with data_pack=0.
+	if (pack.reported) {
+		return;
+	}
+	pack.reported = true;
+	long long syscalls = pack.syscalls, bytes = pack.bytes;
+	bool io = ReadProcessIO(&syscalls, &bytes);
+	char details[128] = "";
+	if (io) {
+		snprintf(details, sizeof(details), ", %lld read syscalls for %.1f MB", syscalls - pack.syscalls, (bytes - pack.bytes) / 1048576.0);
+	}
+	PrintConsole(game, "Data: %s after %.0f ms; %d files from the pack, %d loose%s", milestone, (al_get_time() - pack.start) * 1000,
+		atomic_load(&pack.packed), atomic_load(&pack.loose), details);
+}
+
+// building the pack
+
+static bool IsPackable(const char* name) {
+	const char* extensions[] = {".flac", ".ogg", ".wav", ".png", ".ttf", ".txt", NULL};
+	const char* extension = strrchr(name, '.');
+	if (!extension || strncmp(name, "icons/", 6) == 0) {
+		return false;
+	}
+	for (int i = 0; extensions[i]; i++) {
+		if (strcmp(extension, extensions[i]) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool IsAudio(const char* name) {
+	const char* extension = strrchr(name, '.');
+	return strcmp(extension, ".flac") == 0 || strcmp(extension, ".ogg") == 0 || strcmp(extension, ".wav") == 0;
+}
+
+static void CollectFiles(const char* root, ALLEGRO_FS_ENTRY* dir, char*** names, int* count) {
+	if (!al_open_directory(dir)) {
+		return;
+	}
+	ALLEGRO_FS_ENTRY* entry;
+	while ((entry = al_read_directory(dir))) {
+		if (al_get_fs_entry_mode(entry) & ALLEGRO_FILEMODE_ISDIR) {
+			CollectFiles(root, entry, names, count);
+		} else {
+			char* name = strdup(al_get_fs_entry_name(entry) + strlen(root) + 1);
+			for (char* c = name; *c; c++) {
+				*c = *c == '\\' ? '/' : *c;
+			}
+			if (IsPackable(name) && strlen(name) < PACK_NAME_LENGTH) {
+				*names = realloc(*names, sizeof(char*) * (*count + 1));
+				(*names)[(*count)++] = name;
+			} else {
+				free(name);
+			}
+		}
+		al_destroy_fs_entry(entry);
+	}
+	al_close_directory(dir);
+}
+
+static unsigned char* EncodeAudio(const char* path, unsigned int rate, uint64_t* size) {
+	// decoded and resampled (linearly, as the mixer would) into a 16-bit WAV
+	ALLEGRO_SAMPLE* sample = al_load_sample(path);
+	if (!sample) {
+		return NULL;
+	}
+	uint16_t channels = al_get_channel_count(al_get_sample_channels(sample));
+	unsigned int length = al_get_sample_length(sample);
+	double step = al_get_sample_frequency(sample) / (double)rate;
+	uint32_t frames = length / step;
+	uint32_t data = frames * channels * sizeof(int16_t);
+	*size = 44 + data;
+	unsigned char* buffer = malloc(*size);
+
+	uint32_t riff = data + 36, fmt = 16, byte_rate = rate * channels * sizeof(int16_t);
+	uint16_t format = 1, align = channels * sizeof(int16_t), bits = 16;
+	unsigned char* p = buffer;
+#define PUT(src, n) \
+	memcpy(p, src, n); \
+	p += n
+	PUT("RIFF", 4);
+	PUT(&riff, 4);
+	PUT("WAVEfmt ", 8);
+	PUT(&fmt, 4);
+	PUT(&format, 2);
+	PUT(&channels, 2);
+	PUT(&rate, 4);
+	PUT(&byte_rate, 4);
+	PUT(&align, 2);
+	PUT(&bits, 2);
+	PUT("data", 4);
+	PUT(&data, 4);
+#undef PUT
+
+	int16_t* out = (int16_t*)p;
+	for (uint32_t i = 0; i < frames; i++) {
+		double position = i * step;
+		unsigned int a = position, b = a + 1 < length ? a + 1 : a;
+		float t = position - a;
+		for (int c = 0; c < channels; c++) {
+			float value = GetSampleValue(sample, a, c) * (1 - t) + GetSampleValue(sample, b, c) * t;
+			out[i * channels + c] = fmaxf(-32768, fminf(32767, roundf(value * 32768)));
+		}
+	}
+	al_destroy_sample(sample);
+	return buffer;
+}
+
+static int CompareNames(const void* a, const void* b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+int RunDataPack(int* argc, char** argv) {
+	// bob --pack <data directory> <output> [--pack-rate <Hz>]
+	// returns -1 when not requested, so the game can start normally
+	const char *root = NULL, *output = NULL;
+	unsigned int rate = PACK_DEFAULT_RATE;
+	int out = 1;
+	for (int i = 1; i < *argc; i++) {
+		if (strcmp(argv[i], "--pack") == 0 && i + 2 < *argc) {
+			root = argv[++i];
+			output = argv[++i];
+		} else if (strcmp(argv[i], "--pack-rate") == 0 && i + 1 < *argc) {
+			rate = strtol(argv[++i], NULL, 10);
+		} else {
+			argv[out++] = argv[i];
+		}
+	}
+	*argc = out;
+	if (!root) {
+		return -1;
+	}
+
+	al_init();
+	al_init_acodec_addon();
+	double start = al_get_time();
+
+	char** names = NULL;
+	int count = 0;
+	ALLEGRO_FS_ENTRY* dir = al_create_fs_entry(root);
+	char* prefix = strdup(al_get_fs_entry_name(dir)); // normalized the same way as the entries inside
+	CollectFiles(prefix, dir, &names, &count);
+	al_destroy_fs_entry(dir);
+	free(prefix);
+	qsort(names, count, sizeof(char*), CompareNames);
+
+	FILE* file = fopen(output, "wb");
+	if (!file) {
+		fprintf(stderr, "Couldn't write %s\n", output);
+		return 1;
+	}
+	struct PackHeader header = {.rate = rate};
+	memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+	struct PackEntry* entries = calloc(count, sizeof(struct PackEntry));
+	// room for every entry, though the ones that fail don't get written, so the loose files stay in use
+	uint64_t offset = sizeof(struct PackHeader) + count * sizeof(struct PackEntry);
+	int audio = 0, failed = 0;
+
+	fseek(file, offset, SEEK_SET);
+	for (int i = 0; i < count; i++) {
+		char path[1024];
+		snprintf(path, sizeof(path), "%s/%s", root, names[i]);
+		unsigned char* data = NULL;
+		uint64_t size = 0;
+		bool encoded = IsAudio(names[i]);
+		if (encoded) {
+			data = EncodeAudio(path, rate, &size);
+			audio += !!data;
+		} else {
+			FILE* in = fopen(path, "rb");
+			if (in) {
+				fseek(in, 0, SEEK_END);
+				size = ftell(in);
+				fseek(in, 0, SEEK_SET);
+				data = malloc(size);
+				size = fread(data, 1, size, in);
+				fclose(in);
+			}
+		}
+		if (!data) {
+			fprintf(stderr, "Couldn't pack %s\n", path);
+			failed++;
+			free(names[i]);
+			continue;
+		}
+
+		offset = (offset + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT;
+		fseek(file, offset, SEEK_SET);
+		fwrite(data, 1, size, file);
+		struct PackEntry* entry = &entries[header.count++];
+		strncpy(entry->name, names[i], PACK_NAME_LENGTH - 1);
+		entry->offset = offset;
+		entry->size = size;
+		entry->audio = encoded;
+		offset += size;
+		free(data);
+		free(names[i]);
+	}
+	fseek(file, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(entries, sizeof(struct PackEntry), header.count, file);
+	fclose(file);
+
+	printf("Packed %u files (%d of them audio, decoded at %u Hz) into %s: %.1f MB in %.1f s\n", header.count, audio, rate, output, offset / 1048576.0, al_get_time() - start);
+	free(entries);
+	free(names);
+	al_uninstall_system();
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,210 @@
+/*! \file prefetch.c
+ *  \brief Audio streams opened in the background ahead of being played.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <libsuperderpy.h>
+
+#define PREFETCH_SLOTS 4
+#define PREFETCH_BUFFERS 4 // fragments in each stream's queue
+#define PREFETCH_BUFFER_SAMPLES 2048 // that's ~190 ms of audio queued at 44.1 kHz
+
+enum PrefetchState {
+	PREFETCH_EMPTY,
+	PREFETCH_QUEUED,
+	PREFETCH_LOADING,
+	PREFETCH_READY,
+};
+
+struct AudioPrefetch {
+	struct Game* game;
+	ALLEGRO_THREAD* thread;
+	ALLEGRO_MUTEX* mutex;
+	ALLEGRO_COND* cond;
+	struct {
+		enum PrefetchState state;
+		char path[1024]; // within the data directory
+		ALLEGRO_FILE* file; // opened by the caller, so the data pack's bookkeeping stays on one thread
+		const char* ident;
+		ALLEGRO_AUDIO_STREAM* stream;
+		double requested;
+	} slots[PREFETCH_SLOTS];
+	int hits, misses;
+};
+
+static ALLEGRO_AUDIO_STREAM* OpenStream(ALLEGRO_FILE* file, const char* ident) {
+	// Opening the file and decoding the first fragments is what causes the hitch,
+	// the stream keeps itself fed from Allegro's own thread afterwards. It owns the file from now on.
+	ALLEGRO_AUDIO_STREAM* stream = file ? al_load_audio_stream_f(file, ident, PREFETCH_BUFFERS, PREFETCH_BUFFER_SAMPLES) : NULL;
+	if (!stream && file) {
+		al_fclose(file);
+	}
+	if (stream) {
+		al_set_audio_stream_playing(stream, false);
+		al_set_audio_stream_playmode(stream, ALLEGRO_PLAYMODE_ONCE);
+	}
+	return stream;
+}
+
+static void* PrefetchThread(ALLEGRO_THREAD* thread, void* arg) {
+	struct AudioPrefetch* prefetch = arg;
+	al_lock_mutex(prefetch->mutex);
+	while (!al_get_thread_should_stop(thread)) {
+		int slot = -1;
+		for (int i = 0; i < PREFETCH_SLOTS; i++) {
+			if (prefetch->slots[i].state == PREFETCH_QUEUED) {
+				slot = i;
+				break;
+			}
+		}
+		if (slot < 0) {
+			al_wait_cond(prefetch->cond, prefetch->mutex);
+			continue;
+		}
+		prefetch->slots[slot].state = PREFETCH_LOADING;
+		ALLEGRO_FILE* file = prefetch->slots[slot].file;
+		const char* ident = prefetch->slots[slot].ident;
+		prefetch->slots[slot].file = NULL;
+		al_unlock_mutex(prefetch->mutex);
+
+		ALLEGRO_AUDIO_STREAM* stream = TrackAudioStream(prefetch->game, OpenStream(file, ident));
+
+		al_lock_mutex(prefetch->mutex);
+		prefetch->slots[slot].stream = stream;
+		prefetch->slots[slot].state = PREFETCH_READY;
+		al_broadcast_cond(prefetch->cond);
+	}
+	al_unlock_mutex(prefetch->mutex);
+	return NULL;
+}
+
+struct AudioPrefetch* CreateAudioPrefetch(struct Game* game) {
+	struct AudioPrefetch* prefetch = calloc(1, sizeof(struct AudioPrefetch));
+	prefetch->game = game;
+	prefetch->mutex = al_create_mutex();
+	prefetch->cond = al_create_cond();
+	prefetch->thread = al_create_thread(PrefetchThread, prefetch);
+	al_start_thread(prefetch->thread);
+	return prefetch;
+}
+
+void PrefetchAudioStream(struct Game* game, struct AudioPrefetch* prefetch, const char* path) {
+	al_lock_mutex(prefetch->mutex);
+	int slot = -1;
+	for (int i = 0; i < PREFETCH_SLOTS; i++) {
+		if (prefetch->slots[i].state != PREFETCH_EMPTY && strcmp(prefetch->slots[i].path, path) == 0) {
+			// already there or on its way
+			prefetch->slots[i].requested = al_get_time();
+			al_unlock_mutex(prefetch->mutex);
+			return;
+		}
+		if (prefetch->slots[i].state == PREFETCH_EMPTY) {
+			slot = i;
+		} else if (prefetch->slots[i].state == PREFETCH_READY && (slot < 0 || (prefetch->slots[slot].state == PREFETCH_READY && prefetch->slots[i].requested < prefetch->slots[slot].requested))) {
+			slot = i;
+		}
+	}
+	if (slot < 0) {
+		// everything's busy loading, so this guess will have to do without
+		al_unlock_mutex(prefetch->mutex);
+		return;
+	}
+	if (prefetch->slots[slot].stream) {
+		// the stalest prediction makes room
+		DestroyTrackedAudioStream(game, prefetch->slots[slot].stream);
+		prefetch->slots[slot].stream = NULL;
+	}
+	prefetch->slots[slot].file = OpenDataFile(game, path, &prefetch->slots[slot].ident);
+	prefetch->slots[slot].state = PREFETCH_QUEUED;
+	prefetch->slots[slot].requested = al_get_time();
+	strncpy(prefetch->slots[slot].path, path, sizeof(prefetch->slots[slot].path) - 1);
+	al_broadcast_cond(prefetch->cond);
+	al_unlock_mutex(prefetch->mutex);
+}
+
+ALLEGRO_AUDIO_STREAM* TakeAudioStream(struct Game* game, struct AudioPrefetch* prefetch, const char* path) {
+	// the caller owns the returned stream and releases it with DestroyTrackedAudioStream;
+	// it's opened right away when it wasn't predicted
+	al_lock_mutex(prefetch->mutex);
+	for (int i = 0; i < PREFETCH_SLOTS; i++) {
+		if (prefetch->slots[i].state == PREFETCH_EMPTY || strcmp(prefetch->slots[i].path, path) != 0) {
+			continue;
+		}
+		while (prefetch->slots[i].state != PREFETCH_READY) {
+			al_wait_cond(prefetch->cond, prefetch->mutex);
+		}
+		ALLEGRO_AUDIO_STREAM* stream = prefetch->slots[i].stream;
+		prefetch->slots[i].stream = NULL;
+		prefetch->slots[i].state = PREFETCH_EMPTY;
+		prefetch->hits++;
+		al_unlock_mutex(prefetch->mutex);
+		return stream;
+	}
+	prefetch->misses++;
+	al_unlock_mutex(prefetch->mutex);
+	if (game->config.debug.enabled) {
+		PrintConsole(game, "Audio prefetch: %s wasn't predicted, opening it now", path);
+	}
+	const char* ident;
+	ALLEGRO_FILE* file = OpenDataFile(game, path, &ident);
+	return TrackAudioStream(game, OpenStream(file, ident));
+}
+
+void AdoptAudioStream(struct AudioPrefetch* prefetch, const char* path, ALLEGRO_AUDIO_STREAM* stream) {
+	// for tracked streams opened ahead of time elsewhere; counts as prefetched, unless there's no room for it
+	if (!stream) {
+		return;
+	}
+	al_lock_mutex(prefetch->mutex);
+	for (int i = 0; i < PREFETCH_SLOTS; i++) {
+		if (prefetch->slots[i].state == PREFETCH_EMPTY) {
+			prefetch->slots[i].state = PREFETCH_READY;
+			prefetch->slots[i].stream = stream;
+			prefetch->slots[i].requested = al_get_time();
+			strncpy(prefetch->slots[i].path, path, sizeof(prefetch->slots[i].path) - 1);
+			al_unlock_mutex(prefetch->mutex);
+			return;
+		}
+	}
+	al_unlock_mutex(prefetch->mutex);
+	DestroyTrackedAudioStream(prefetch->game, stream);
+}
+
+void DestroyAudioPrefetch(struct Game* game, struct AudioPrefetch* prefetch) {
+	al_lock_mutex(prefetch->mutex);
+	al_set_thread_should_stop(prefetch->thread);
+	al_broadcast_cond(prefetch->cond);
+	al_unlock_mutex(prefetch->mutex);
+	al_join_thread(prefetch->thread, NULL);
+	al_destroy_thread(prefetch->thread);
+
+	for (int i = 0; i < PREFETCH_SLOTS; i++) {
+		if (prefetch->slots[i].stream) {
+			DestroyTrackedAudioStream(game, prefetch->slots[i].stream);
+		}
+		if (prefetch->slots[i].file) {
+			// queued, but never got to
+			al_fclose(prefetch->slots[i].file);
+		}
+	}
+	PrintConsole(game, "Audio prefetch: %d of %d streams were ready in advance", prefetch->hits, prefetch->hits + prefetch->misses);
+	al_destroy_cond(prefetch->cond);
+	al_destroy_mutex(prefetch->mutex);
+	free(prefetch);
+}
@@ -0,0 +1,202 @@
+/*! \file preload.c
+ *  \brief Resources of the gamestates coming up next, loaded in the background before they're switched to.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <libsuperderpy.h>
+
+#define PRELOAD_DEFAULT_BUDGET "32" // MB held by gamestates that were preloaded, but haven't been switched to yet
+
+// What each gamestate loads from the disk, in the order LoadGamestateResources returns it in.
+// Gamestates are separate libraries which aren't there before they get loaded, so it's kept here.
+static const struct {
+	const char* gamestate;
+	struct LoadJob jobs[PRELOAD_MAX_JOBS];
+	int count;
+} RESOURCES[] = {
+	{"game", {{.load = LoadStreamJob, .file = "voice/1.flac", .buffers = 4, .size = 2048}}, 1},
+	{"heaven", {{.load = LoadStreamJob, .file = "heaven.flac", .buffers = 4, .size = 2048}, {.load = LoadBitmapJob, .file = "shod.png"}}, 2},
+};
+
+static int FindResources(const char* name) {
+	for (size_t i = 0; i < sizeof(RESOURCES) / sizeof(RESOURCES[0]); i++) {
+		if (strcmp(RESOURCES[i].gamestate, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static struct Preload* FindPreload(struct Game* game, const char* name) {
+	for (int i = 0; i < PRELOAD_SLOTS; i++) {
+		if (game->data->preload.slots[i].gamestate && strcmp(game->data->preload.slots[i].gamestate, name) == 0) {
+			return &game->data->preload.slots[i];
+		}
+	}
+	return NULL;
+}
+
+static size_t MeasureResult(struct LoadJob* job) {
+	// what's kept in memory, roughly
+	if (job->load == LoadBitmapJob) {
+		return MeasureBitmap(job->result);
+	}
+	if (job->load == LoadSampleJob) {
+		return MeasureSample(job->result);
+	}
+	if (job->load == LoadStreamJob) {
+		return MeasureAudioStream(job->result);
+	}
+	return 0;
+}
+
+static void ReleasePreload(struct Game* game, struct Preload* preload) {
+	if (preload->loader) {
+		FinishLoadJobs(game, preload->loader, NULL);
+	}
+	for (int i = 0; i < preload->count; i++) {
+		DestroyLoadJobResult(game, &preload->jobs[i]);
+	}
+	game->data->preload.held -= preload->bytes;
+	*preload = (struct Preload){0};
+}
+
+void InitPreloads(struct Game* game) {
+	game->data->preload.mutex = al_create_mutex();
+	game->data->preload.budget = strtod(GetConfigOptionDefault(game, "Bob", "preload_budget", PRELOAD_DEFAULT_BUDGET), NULL) * 1048576;
+}
+
+void PreloadGamestate(struct Game* game, const char* name) {
+	// Starts loading what the gamestate will need, so switching to it later doesn't have to wait.
+	int resources = FindResources(name);
+	if (resources < 0) {
+		return;
+	}
+	struct Preload* preload = NULL;
+	al_lock_mutex(game->data->preload.mutex);
+	if (FindPreload(game, name)) {
+		al_unlock_mutex(game->data->preload.mutex);
+		return;
+	}
+	for (int i = 0; i < PRELOAD_SLOTS; i++) {
+		struct Preload* slot = &game->data->preload.slots[i];
+		if (!slot->gamestate) {
+			preload = slot;
+			break;
+		}
+		if (!preload || slot->requested < preload->requested) {
+			preload = slot;
+		}
+	}
+	if (preload->gamestate) {
+		PrintConsole(game, "Preload: dropping %s to make room for %s", preload->gamestate, name);
+		ReleasePreload(game, preload);
+	}
+	preload->gamestate = RESOURCES[resources].gamestate;
+	preload->count = RESOURCES[resources].count;
+	memcpy(preload->jobs, RESOURCES[resources].jobs, sizeof(preload->jobs));
+	preload->requested = al_get_time();
+	preload->loader = StartLoadJobs(game, preload->jobs, preload->count);
+	al_unlock_mutex(game->data->preload.mutex);
+}
+
+void LoadGamestateResources(struct Game* game, const char* name, void** results, void (*progress)(struct Game*)) {
+	// Fills results in the order of the gamestate's entry in RESOURCES; they belong to the caller from now on.
+	// Whatever was preloaded gets taken over, the rest is loaded right away.
+	al_lock_mutex(game->data->preload.mutex);
+	struct Preload* found = FindPreload(game, name);
+	struct Preload preload = {0};
+	if (found) {
+		preload = *found;
+		game->data->preload.held -= found->bytes;
+		game->data->preload.hits++;
+		*found = (struct Preload){0};
+	} else {
+		game->data->preload.misses++;
+	}
+	al_unlock_mutex(game->data->preload.mutex);
+
+	if (!found) {
+		int resources = FindResources(name);
+		if (resources < 0) {
+			return;
+		}
+		preload.count = RESOURCES[resources].count;
+		memcpy(preload.jobs, RESOURCES[resources].jobs, sizeof(preload.jobs));
+		preload.loader = StartLoadJobs(game, preload.jobs, preload.count);
+	}
+	if (preload.loader) {
+		FinishLoadJobs(game, preload.loader, progress);
+	} else {
+		for (int i = 0; i < preload.count; i++) {
+			progress(game);
+		}
+	}
+	for (int i = 0; i < preload.count; i++) {
+		results[i] = preload.jobs[i].result;
+	}
+	if (game->config.debug.enabled) {
+		PrintConsole(game, "Preload: %s was %s", name, found ? (preload.loader ? "still loading" : "ready") : "not preloaded");
+	}
+}
+
+void UpdatePreloads(struct Game* game) {
+	// Finished preloads get measured, and the ones requested longest ago go when there's too much held.
+	struct CommonResources* data = game->data;
+	al_lock_mutex(data->preload.mutex);
+	for (int i = 0; i < PRELOAD_SLOTS; i++) {
+		struct Preload* preload = &data->preload.slots[i];
+		if (!preload->gamestate || !preload->loader || !IsLoadFinished(preload->loader)) {
+			continue;
+		}
+		FinishLoadJobs(game, preload->loader, NULL);
+		preload->loader = NULL;
+		for (int j = 0; j < preload->count; j++) {
+			preload->bytes += MeasureResult(&preload->jobs[j]);
+		}
+		data->preload.held += preload->bytes;
+		if (game->config.debug.enabled) {
+			PrintConsole(game, "Preload: %s ready, %.1f MB held in total", preload->gamestate, data->preload.held / 1048576.0);
+		}
+	}
+	while (data->preload.held > data->preload.budget) {
+		struct Preload* oldest = NULL;
+		for (int i = 0; i < PRELOAD_SLOTS; i++) {
+			struct Preload* preload = &data->preload.slots[i];
+			if (preload->gamestate && !preload->loader && (!oldest || preload->requested < oldest->requested)) {
+				oldest = preload;
+			}
+		}
+		PrintConsole(game, "Preload: %.1f MB over the budget, dropping %s", (data->preload.held - data->preload.budget) / 1048576.0, oldest->gamestate);
+		ReleasePreload(game, oldest);
+	}
+	al_unlock_mutex(data->preload.mutex);
+}
+
+void DestroyPreloads(struct Game* game) {
+	for (int i = 0; i < PRELOAD_SLOTS; i++) {
+		if (game->data->preload.slots[i].gamestate) {
+			ReleasePreload(game, &game->data->preload.slots[i]);
+		}
+	}
+	if (game->data->preload.hits + game->data->preload.misses) {
+		PrintConsole(game, "Preload: %d of %d gamestates were ready in advance", game->data->preload.hits, game->data->preload.hits + game->data->preload.misses);
+	}
+	al_destroy_mutex(game->data->preload.mutex);
+}
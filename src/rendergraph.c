@@ -0,0 +1,375 @@
+/*! \file rendergraph.c
+ *  \brief Post-processing passes described as a graph over pooled render targets.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <libsuperderpy.h>
+
+static int SizeClass(int size) {
+	// round up to an eighth of the next power of two, so close sizes end up sharing a texture
+	int pot = 16;
+	while (pot < size) {
+		pot *= 2;
+	}
+	int step = fmax(16, pot / 8);
+	return (size + step - 1) / step * step;
+}
+
+static ALLEGRO_BITMAP* AcquireRenderTarget(struct Game* game, int width, int height) {
+	struct CommonResources* data = game->data;
+	int w = SizeClass(width), h = SizeClass(height);
+	int slot = -1;
+
+	for (int i = 0; i < RENDER_TARGET_POOL_SIZE; i++) {
+		if (data->pool[i].bitmap && !data->pool[i].used && al_get_bitmap_width(data->pool[i].bitmap) == w && al_get_bitmap_height(data->pool[i].bitmap) == h) {
+			slot = i;
+			break;
+		}
+	}
+
+	if (slot < 0) {
+		// nothing to reuse, so take an empty slot or evict the least recently released texture
+		for (int i = 0; i < RENDER_TARGET_POOL_SIZE; i++) {
+			if (data->pool[i].used) {
+				continue;
+			}
+			if (!data->pool[i].bitmap) {
+				slot = i;
+				break;
+			}
+			if (slot < 0 || data->pool[i].released < data->pool[slot].released) {
+				slot = i;
+			}
+		}
+		if (slot < 0) {
+			PrintConsole(game, "Render target pool exhausted, allocating %dx%d outside of it", width, height);
+			return TrackBitmap(game, MEMORY_TARGETS, CreateNotPreservedBitmap(width, height));
+		}
+		if (data->pool[slot].bitmap) {
+			DestroyTrackedBitmap(game, MEMORY_TARGETS, data->pool[slot].bitmap);
+		}
+		data->pool[slot].bitmap = TrackBitmap(game, MEMORY_TARGETS, CreateNotPreservedBitmap(w, h));
+		PrintConsole(game, "Render target pool: allocated %dx%d texture for %dx%d", w, h, width, height);
+	}
+
+	data->pool[slot].used = true;
+
+	// the whole texture gets cleared, so filters sampling past the edge of the sub-bitmap read transparency
+	al_set_target_bitmap(data->pool[slot].bitmap);
+	al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+	return al_create_sub_bitmap(data->pool[slot].bitmap, 0, 0, width, height);
+}
+
+static void ReleaseRenderTarget(struct Game* game, ALLEGRO_BITMAP* bitmap) {
+	ALLEGRO_BITMAP* parent = al_get_parent_bitmap(bitmap);
+	for (int i = 0; parent && i < RENDER_TARGET_POOL_SIZE; i++) {
+		if (game->data->pool[i].bitmap == parent) {
+			game->data->pool[i].used = false;
+			game->data->pool[i].released = al_get_time();
+			break;
+		}
+	}
+	// a sub-bitmap of a pooled texture counts as nothing, one made outside of the pool as itself
+	DestroyTrackedBitmap(game, MEMORY_TARGETS, bitmap);
+}
+
+static void EvictRenderTarget(struct Game* game, int slot) {
+	if (game->config.debug.enabled) {
+		PrintConsole(game, "Render target pool: freed unused %dx%d texture", al_get_bitmap_width(game->data->pool[slot].bitmap), al_get_bitmap_height(game->data->pool[slot].bitmap));
+	}
+	DestroyTrackedBitmap(game, MEMORY_TARGETS, game->data->pool[slot].bitmap);
+	game->data->pool[slot].bitmap = NULL;
+}
+
+void TrimRenderTargetPool(struct Game* game) {
+	// Released textures are kept around for the next resize or resolution step, but not for long,
+	// and not more of them than RENDER_TARGET_POOL_SPARE, as they pin video memory nobody uses.
+	struct CommonResources* data = game->data;
+	double now = al_get_time();
+	size_t spare = 0;
+	for (int i = 0; i < RENDER_TARGET_POOL_SIZE; i++) {
+		if (!data->pool[i].bitmap || data->pool[i].used) {
+			continue;
+		}
+		if (now - data->pool[i].released > RENDER_TARGET_POOL_IDLE) {
+			EvictRenderTarget(game, i);
+		} else {
+			spare += MeasureBitmap(data->pool[i].bitmap);
+		}
+	}
+	while (spare > RENDER_TARGET_POOL_SPARE) {
+		int oldest = -1;
+		for (int i = 0; i < RENDER_TARGET_POOL_SIZE; i++) {
+			if (data->pool[i].bitmap && !data->pool[i].used && (oldest < 0 || data->pool[i].released < data->pool[oldest].released)) {
+				oldest = i;
+			}
+		}
+		spare -= MeasureBitmap(data->pool[oldest].bitmap);
+		EvictRenderTarget(game, oldest);
+	}
+}
+
+void DestroyRenderTargetPool(struct Game* game) {
+	for (int i = 0; i < RENDER_TARGET_POOL_SIZE; i++) {
+		if (game->data->pool[i].bitmap) {
+			DestroyTrackedBitmap(game, MEMORY_TARGETS, game->data->pool[i].bitmap);
+		}
+	}
+}
+
+void GetTextureSize(ALLEGRO_BITMAP* bitmap, float size[2]) {
+	ALLEGRO_BITMAP* texture = al_get_parent_bitmap(bitmap) ? al_get_parent_bitmap(bitmap) : bitmap;
+	size[0] = al_get_bitmap_width(texture);
+	size[1] = al_get_bitmap_height(texture);
+}
+
+void GetTextureRegion(ALLEGRO_BITMAP* bitmap, float region[4]) {
+	// texture coordinates of a (sub-)bitmap within its texture, which is stored upside down
+	float size[2];
+	GetTextureSize(bitmap, size);
+	region[0] = al_get_bitmap_x(bitmap) / size[0];
+	region[1] = 1.0 - (al_get_bitmap_y(bitmap) + al_get_bitmap_height(bitmap)) / size[1];
+	region[2] = (al_get_bitmap_x(bitmap) + al_get_bitmap_width(bitmap)) / size[0];
+	region[3] = 1.0 - al_get_bitmap_y(bitmap) / size[1];
+}
+
+static size_t TextureMemory(int width, int height) {
+	// what the pool actually allocates for a target of that size, assuming RGBA8
+	return (size_t)SizeClass(width) * SizeClass(height) * 4;
+}
+
+int AddRenderResource(struct RenderGraph* graph, const char* name, int width, int height) {
+	struct RenderResource* resource = &graph->resources[graph->resource_count];
+	*resource = (struct RenderResource){.name = name, .width = fmax(1, width), .height = fmax(1, height), .first = -1, .last = -1, .final = -1, .physical = -1};
+	return graph->resource_count++;
+}
+
+int AddRenderPass(struct RenderGraph* graph, struct RenderPass pass) {
+	graph->passes[graph->pass_count] = pass;
+	return graph->pass_count++;
+}
+
+void CompileRenderGraph(struct Game* game, struct RenderGraph* graph) {
+	// find out when each resource is alive within a frame
+	for (int i = 0; i < graph->pass_count; i++) {
+		struct RenderPass* pass = &graph->passes[i];
+		for (int j = 0; j < pass->input_count; j++) {
+			struct RenderResource* resource = &graph->resources[pass->inputs[j]];
+			if (resource->first < 0) {
+				// read before anything wrote it this frame, so it's what the previous frame left there
+				resource->persistent = true;
+			}
+			resource->last = i;
+		}
+		if (pass->output != RENDER_GRAPH_BACKBUFFER) {
+			struct RenderResource* resource = &graph->resources[pass->output];
+			if (resource->first < 0) {
+				resource->first = i;
+			}
+			if (pass->reusable) {
+				// a skipped pass relies on its output still being there from the previous frame,
+				// the passes skipped along with it only on theirs being used up within the run
+				resource->persistent = true;
+			}
+			resource->last = i;
+			resource->final = i;
+		}
+	}
+
+	// Resources are handed out in the order they're first written. One that isn't needed anymore
+	// gives its bitmap to the next resource that fits in it, unless either one has to outlive the frame;
+	// of those that fit, the smallest one is taken.
+	size_t naive = 0, aliased = 0;
+	graph->physical_count = 0;
+	for (int i = 0; i < graph->pass_count; i++) {
+		int output = graph->passes[i].output;
+		if (output == RENDER_GRAPH_BACKBUFFER || graph->resources[output].physical >= 0) {
+			continue;
+		}
+		struct RenderResource* resource = &graph->resources[output];
+		for (int j = 0; j < graph->physical_count && !resource->persistent; j++) {
+			ALLEGRO_BITMAP* bitmap = graph->physical[j].bitmap;
+			if (graph->physical[j].persistent || graph->physical[j].last >= resource->first ||
+				al_get_bitmap_width(bitmap) < resource->width || al_get_bitmap_height(bitmap) < resource->height) {
+				continue;
+			}
+			ALLEGRO_BITMAP* best = resource->physical >= 0 ? graph->physical[resource->physical].bitmap : NULL;
+			if (!best || al_get_bitmap_width(bitmap) * al_get_bitmap_height(bitmap) < al_get_bitmap_width(best) * al_get_bitmap_height(best)) {
+				resource->physical = j;
+			}
+		}
+		if (resource->physical < 0) {
+			resource->physical = graph->physical_count++;
+			graph->physical[resource->physical].bitmap = AcquireRenderTarget(game, resource->width, resource->height);
+			graph->physical[resource->physical].persistent = resource->persistent;
+			graph->physical[resource->physical].owner = -1; // nothing yet
+			graph->physical[resource->physical].gpu_valid = true;
+			graph->physical[resource->physical].cpu_valid = false;
+			graph->physical[resource->physical].last = -1;
+			aliased += TextureMemory(resource->width, resource->height);
+		}
+		ALLEGRO_BITMAP* bitmap = graph->physical[resource->physical].bitmap;
+		resource->view = bitmap;
+		if (al_get_bitmap_width(bitmap) != resource->width || al_get_bitmap_height(bitmap) != resource->height) {
+			resource->view = al_create_sub_bitmap(bitmap, 0, 0, resource->width, resource->height);
+		}
+		graph->physical[resource->physical].last = fmax(graph->physical[resource->physical].last, resource->last);
+		naive += TextureMemory(resource->width, resource->height);
+
+		if (game->config.debug.verbose) {
+			PrintConsole(game, "Render graph: %s (%dx%d) alive in passes %d-%d%s, bitmap %d", resource->name, resource->width, resource->height,
+				resource->first, resource->last, resource->persistent ? " and across frames" : "", resource->physical);
+		}
+	}
+
+	PrintConsole(game, "Render graph: %d passes, %d resources in %d bitmaps, peak %.1f MB (%.1f MB without aliasing)",
+		graph->pass_count, graph->resource_count, graph->physical_count, aliased / 1048576.0, naive / 1048576.0);
+}
+
+static void SyncPhysical(struct Game* game, struct RenderGraph* graph, int index, bool cpu) {
+	// bring the copy on the side that's about to be used up to date
+	struct RenderResource* resource = &graph->resources[index];
+	if (cpu && !graph->physical[resource->physical].cpu_valid) {
+		CpuImageFromBitmap(game, &graph->physical[resource->physical].image, resource->view);
+		graph->physical[resource->physical].cpu_valid = true;
+	}
+	if (!cpu && !graph->physical[resource->physical].gpu_valid) {
+		CpuImageToBitmap(game, &graph->physical[resource->physical].image, resource->view);
+		graph->physical[resource->physical].gpu_valid = true;
+	}
+}
+
+static int FindReusedRun(struct RenderGraph* graph, int start) {
+	// Passes with reuse set get skipped together, from start up to the first pass by which everything
+	// they wrote is either used up or kept for the next frame, as intermediate results sharing their
+	// bitmaps with others are gone by then. Returns the last pass of the run, -1 when there's none.
+	for (int i = start; i < graph->pass_count && graph->passes[i].reuse && graph->passes[i].output != RENDER_GRAPH_BACKBUFFER; i++) {
+		bool closed = true;
+		for (int j = start; j <= i && closed; j++) {
+			struct RenderResource* resource = &graph->resources[graph->passes[j].output];
+			closed = resource->persistent ? resource->final <= i : resource->last <= i;
+		}
+		if (closed) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static bool IsReusedRunIntact(struct RenderGraph* graph, int start, int end) {
+	// nothing it reads got redrawn this frame, and what it keeps for later is still in its bitmaps
+	for (int i = start; i <= end; i++) {
+		struct RenderPass* pass = &graph->passes[i];
+		for (int j = 0; j < pass->input_count; j++) {
+			if (graph->resources[pass->inputs[j]].written) {
+				return false;
+			}
+		}
+		struct RenderResource* resource = &graph->resources[pass->output];
+		if (resource->persistent && graph->physical[resource->physical].owner != pass->output) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void ExecuteRenderGraph(struct Game* game, struct RenderGraph* graph) {
+	for (int i = 0; i < graph->resource_count; i++) {
+		graph->resources[i].written = false;
+	}
+
+	int forced = -1; // passes up to this one run regardless, as their run couldn't be skipped as a whole
+	for (int i = 0; i < graph->pass_count; i++) {
+		struct RenderPass* pass = &graph->passes[i];
+		if (i > forced && pass->reuse) {
+			int end = FindReusedRun(graph, i);
+			if (end >= 0 && IsReusedRunIntact(graph, i, end)) {
+				i = end;
+				continue;
+			}
+			forced = end;
+		}
+
+		bool cpu = graph->cpu && pass->cpu;
+		ALLEGRO_BITMAP* inputs[RENDER_PASS_MAX_INPUTS];
+		struct CpuImage* images[RENDER_PASS_MAX_INPUTS];
+		for (int j = 0; j < pass->input_count; j++) {
+			struct RenderResource* resource = &graph->resources[pass->inputs[j]];
+			inputs[j] = resource->view;
+			images[j] = &graph->physical[resource->physical].image;
+		}
+
+		if (pass->output == RENDER_GRAPH_BACKBUFFER) {
+			for (int j = 0; j < pass->input_count; j++) {
+				SyncPhysical(game, graph, pass->inputs[j], false);
+			}
+			al_set_target_backbuffer(game->display);
+			al_use_shader(pass->shader ? *pass->shader : NULL);
+			pass->draw(game, pass, inputs, NULL);
+			al_use_shader(NULL);
+			continue;
+		}
+
+		struct RenderResource* resource = &graph->resources[pass->output];
+		for (int j = 0; j < pass->input_count; j++) {
+			SyncPhysical(game, graph, pass->inputs[j], cpu);
+		}
+		if (resource->written) {
+			// drawing on top of what an earlier pass left there
+			SyncPhysical(game, graph, pass->output, cpu);
+		} else if (resource->view != graph->physical[resource->physical].bitmap && graph->physical[resource->physical].owner != pass->output) {
+			// filters sample a bit past the edge, where the bigger resource it took over left its pixels
+			al_set_target_bitmap(graph->physical[resource->physical].bitmap);
+			al_set_clipping_rectangle(0, 0, resource->width + RENDER_GRAPH_VIEW_MARGIN, resource->height + RENDER_GRAPH_VIEW_MARGIN);
+			al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+			al_reset_clipping_rectangle();
+		}
+		graph->physical[resource->physical].owner = pass->output;
+		graph->physical[resource->physical].cpu_valid = cpu;
+		graph->physical[resource->physical].gpu_valid = !cpu;
+		resource->written = true;
+
+		if (cpu) {
+			ResizeCpuImage(game, &graph->physical[resource->physical].image, resource->width, resource->height);
+			pass->cpu(game, pass, images, &graph->physical[resource->physical].image);
+			continue;
+		}
+
+		al_set_target_bitmap(resource->view);
+		al_use_shader(pass->shader ? *pass->shader : NULL);
+		pass->draw(game, pass, inputs, resource->view);
+		al_use_shader(NULL);
+	}
+}
+
+void DestroyRenderGraph(struct Game* game, struct RenderGraph* graph) {
+	for (int i = 0; i < graph->resource_count; i++) {
+		struct RenderResource* resource = &graph->resources[i];
+		if (resource->physical >= 0 && resource->view != graph->physical[resource->physical].bitmap) {
+			al_destroy_bitmap(resource->view);
+		}
+	}
+	for (int i = 0; i < graph->physical_count; i++) {
+		ReleaseRenderTarget(game, graph->physical[i].bitmap);
+		DestroyCpuImage(game, &graph->physical[i].image);
+	}
+	graph->physical_count = 0;
+	graph->resource_count = 0;
+	graph->pass_count = 0;
+}
@@ -0,0 +1,230 @@
+/*! \file script.c
+ *  \brief Narration scripts, compiled once into a flat list of steps and stepped through every frame.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include <libsuperderpy.h>
+#include <stdio.h>
+
+// One step per line, in sections started by [label]:
+//   delay <seconds>
+//   voice [number]   - plays the given voice line, or the next one in line
+//   wait voice       - until the voice line ends, which is the "speaking" flag getting cleared
+//   wait <flag>      - until the flag is set
+//   set <flag>, clear <flag>
+// Flags are resolved to pointers when compiling, so running it is just a switch over the steps.
+// A wait that isn't satisfied parks the script on its flag: it's not looked at again until whoever
+// changes that flag calls SignalScripts, so scripts that wait cost nothing per tick.
+
+static const struct ScriptFlag* FindFlag(const struct ScriptFlag* flags, int count, const char* name) {
+	for (int i = 0; i < count; i++) {
+		if (strcmp(flags[i].name, name) == 0) {
+			return &flags[i];
+		}
+	}
+	return NULL;
+}
+
+static bool CompileLine(struct Script* script, char* line, const struct ScriptFlag* flags, int count, const char** error) {
+	char op[16] = "", arg[32] = "";
+	if (line[0] == '[') {
+		if (script->label_count == SCRIPT_MAX_LABELS) {
+			*error = "too many labels";
+			return false;
+		}
+		if (script->count && script->steps[script->count - 1].op != SCRIPT_END) {
+			script->steps[script->count++] = (struct ScriptStep){.op = SCRIPT_END};
+		}
+		line[strcspn(line, "]")] = 0;
+		snprintf(script->labels[script->label_count].name, sizeof(script->labels[0].name), "%s", line + 1);
+		script->labels[script->label_count++].start = script->count;
+		return true;
+	}
+	if (sscanf(line, "%15s %31s", op, arg) < 1) {
+		return true;
+	}
+	if (!script->label_count) {
+		*error = "step outside of a label";
+		return false;
+	}
+	if (script->count >= SCRIPT_MAX_STEPS - 1) { // there has to be room for the last SCRIPT_END
+		*error = "too many steps";
+		return false;
+	}
+	struct ScriptStep step = {0};
+	if (strcmp(op, "delay") == 0) {
+		step = (struct ScriptStep){.op = SCRIPT_DELAY, .time = strtod(arg, NULL)};
+	} else if (strcmp(op, "voice") == 0) {
+		step = (struct ScriptStep){.op = SCRIPT_VOICE, .arg = arg[0] ? strtol(arg, NULL, 10) : -1};
+	} else if (strcmp(op, "wait") == 0 || strcmp(op, "set") == 0 || strcmp(op, "clear") == 0) {
+		bool voice = strcmp(op, "wait") == 0 && strcmp(arg, "voice") == 0;
+		const struct ScriptFlag* flag = FindFlag(flags, count, voice ? "speaking" : arg);
+		if (!flag) {
+			*error = "unknown flag";
+			return false;
+		}
+		step = (struct ScriptStep){.op = op[0] == 'w' ? SCRIPT_WAIT : SCRIPT_SET, .arg = op[0] != 'c' && !voice, .flag = flag->flag, .name = flag->name};
+	} else {
+		*error = "unknown step";
+		return false;
+	}
+	script->steps[script->count++] = step;
+	return true;
+}
+
+bool CompileScript(struct Game* game, struct Script* script, const char* file, const struct ScriptFlag* flags, int count) {
+	// The voice callbacks and their data have to be set on the script beforehand; they're kept.
+	script->count = 0;
+	script->label_count = 0;
+	ResetScript(game, script);
+
+	const char* ident;
+	ALLEGRO_FILE* fp = OpenDataFile(game, file, &ident);
+	if (!fp) {
+		PrintConsole(game, "Script: couldn't open %s", file);
+		return false;
+	}
+	char line[256];
+	int number = 0;
+	bool ok = true;
+	while (al_fgets(fp, line, sizeof(line))) {
+		number++;
+		line[strcspn(line, "#\r\n")] = 0;
+		const char* error = NULL;
+		if (!CompileLine(script, line + strspn(line, " \t"), flags, count, &error)) {
+			PrintConsole(game, "Script: %s:%d: %s", file, number, error);
+			ok = false;
+		}
+	}
+	al_fclose(fp);
+	script->steps[script->count++] = (struct ScriptStep){.op = SCRIPT_END};
+	if (game->config.debug.enabled) {
+		PrintConsole(game, "Script: %s compiled to %d steps in %d labels", file, script->count, script->label_count);
+	}
+	return ok;
+}
+
+int FindScriptLabel(struct Script* script, const char* name) {
+	for (int i = 0; i < script->label_count; i++) {
+		if (strcmp(script->labels[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void QueueScript(struct Script* script, int label) {
+	// runs right away when nothing else is running, after everything queued before otherwise
+	if (label < 0) {
+		return;
+	}
+	if (script->pc < 0) {
+		script->pc = script->labels[label].start;
+		script->timer = 0;
+	} else if (script->queued < SCRIPT_QUEUE) {
+		script->queue[script->queued++] = label;
+	}
+}
+
+void ResetScript(struct Game* game, struct Script* script) {
+	if (script->parked) {
+		script->parked = NULL;
+		game->data->scripts.parked--;
+	}
+	script->pc = -1;
+	script->timer = 0;
+	script->queued = 0;
+}
+
+void RunScript(struct Game* game, struct Script* script, double delta) {
+	// Steps that don't wait for anything all run within the same frame.
+	while (script->pc >= 0 && !script->parked) {
+		const struct ScriptStep* step = &script->steps[script->pc];
+		switch (step->op) {
+			case SCRIPT_END:
+				script->pc = -1;
+				if (script->queued) {
+					int label = script->queue[0];
+					memmove(script->queue, script->queue + 1, sizeof(int) * --script->queued);
+					QueueScript(script, label);
+				}
+				continue;
+			case SCRIPT_DELAY:
+				script->timer += delta;
+				delta = 0;
+				if (script->timer < step->time) {
+					return;
+				}
+				script->timer = 0;
+				break;
+			case SCRIPT_VOICE:
+				script->voice(game, script->data, step->arg);
+				break;
+			case SCRIPT_WAIT:
+				if (*step->flag != step->arg) {
+					script->parked = step->flag;
+					script->until = step->arg;
+					game->data->scripts.parked++;
+					if (game->config.debug.verbose) {
+						PrintConsole(game, "Script: waiting for %s, %d parked", step->name, game->data->scripts.parked);
+					}
+					return;
+				}
+				break;
+			case SCRIPT_SET:
+				*step->flag = step->arg;
+				SignalScripts(game, step->flag);
+				break;
+		}
+		script->pc++;
+	}
+}
+
+void RegisterScript(struct Game* game, struct Script* script) {
+	// only registered scripts get woken up
+	for (int i = 0; i < game->data->scripts.count; i++) {
+		if (game->data->scripts.running[i] == script) {
+			return;
+		}
+	}
+	if (game->data->scripts.count < SCRIPT_MAX_RUNNING) {
+		game->data->scripts.running[game->data->scripts.count++] = script;
+	}
+}
+
+void UnregisterScript(struct Game* game, struct Script* script) {
+	ResetScript(game, script);
+	for (int i = 0; i < game->data->scripts.count; i++) {
+		if (game->data->scripts.running[i] == script) {
+			game->data->scripts.running[i] = game->data->scripts.running[--game->data->scripts.count];
+			return;
+		}
+	}
+}
+
+void SignalScripts(struct Game* game, const bool* flag) {
+	// to be called after changing a flag scripts may be waiting for
+	for (int i = 0; i < game->data->scripts.count; i++) {
+		struct Script* script = game->data->scripts.running[i];
+		if (script->parked == flag && *flag == script->until) {
+			script->parked = NULL;
+			game->data->scripts.parked--;
+		}
+	}
+}